@@ -13,3 +13,4 @@
 #define TOP_E_REGEX 13
 #define TOP_E_ROOT 14
 #define TOP_E_NODE 15
+#define TOP_E_FROZEN 16
@@ -16,5 +16,6 @@ E(TOP_E_LOOP, "Bad loop boundaries")
 E(TOP_E_REGEX, "Bad regex")
 E(TOP_E_ROOT, "Root not found")
 E(TOP_E_NODE, "No such node")
+E(TOP_E_FROZEN, "Graph is frozen")
 
 E(0, "No error information")
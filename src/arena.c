@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "defs.h"
+#include "arena.h"
+
+/* Blocks are rounded up to power-of-two size classes and carved from large
+ * chunks.  A freed block goes to the free list of its class and is handed
+ * out again by the next allocation of that class; the memory itself is only
+ * returned to the system when the whole arena is destroyed. */
+
+static int
+arena_class (size_t size)
+{
+	int c = 0;
+	while (((size_t) ARENA_MIN_BLOCK << c) < size)
+		c++;
+	return c;
+}
+
+/* usable size of a block allocated for size bytes */
+size_t
+arena_size (size_t size)
+{
+	return (size_t) ARENA_MIN_BLOCK << arena_class(size);
+}
+
+arena_t *
+arena_create (void)
+{
+	return (arena_t *) calloc(1, sizeof(arena_t));
+}
+
+/* carves size bytes from the current chunk, with no size class rounding
+ * and no alignment; such memory cannot be passed to arena_free */
+void *
+arena_bump (arena_t *a, size_t size)
+{
+	arena_chunk_t *c = a->chunks;
+	if (!c || (c->cap - c->used < size)) {
+		/* chunks start small and double, so that the many tiny
+		 * graphs built for products stay cheap */
+		size_t cap = c ? 2 * c->cap : ARENA_FIRST_CHUNK;
+		if (cap > ARENA_CHUNK_SIZE)
+			cap = ARENA_CHUNK_SIZE;
+		if (cap < size)
+			cap = size;
+		c = (arena_chunk_t *) malloc(sizeof(arena_chunk_t) + cap);
+		if (!c) return NULL;
+		c->used = 0;
+		c->cap = cap;
+		/* keep the partially filled chunk on top for small blocks */
+		if (a->chunks && (size > ARENA_CHUNK_SIZE)) {
+			c->next = a->chunks->next;
+			a->chunks->next = c;
+		} else {
+			c->next = a->chunks;
+			a->chunks = c;
+		}
+	}
+	void *p = c->data + c->used;
+	c->used += size;
+	return p;
+}
+
+/* makes sure the next size bytes of bumps come from a single chunk */
+int
+arena_reserve (arena_t *a, size_t size)
+{
+	arena_chunk_t *c = a->chunks;
+	if (c && (c->cap - c->used >= size))
+		return 0;
+	c = (arena_chunk_t *) malloc(sizeof(arena_chunk_t) + size);
+	if (!c) return -1;
+	c->used = 0;
+	c->cap = size;
+	c->next = a->chunks;
+	a->chunks = c;
+	return 0;
+}
+
+void *
+arena_alloc (arena_t *a, size_t size)
+{
+	int c = arena_class(size);
+	void *p = a->free[c];
+	if (p) {
+		a->free[c] = *(void **) p;
+		return p;
+	}
+	return arena_bump(a, (size_t) ARENA_MIN_BLOCK << c);
+}
+
+void
+arena_free (arena_t *a, void *p, size_t size)
+{
+	if (!p) return;
+	int c = arena_class(size);
+	*(void **) p = a->free[c];
+	a->free[c] = p;
+}
+
+void *
+arena_realloc (arena_t *a, void *p, size_t old_size, size_t size)
+{
+	if (p && (arena_class(old_size) == arena_class(size)))
+		return p;
+	void *q = arena_alloc(a, size);
+	if (!q) return NULL;
+	if (p) {
+		memcpy(q, p, (old_size < size) ? old_size : size);
+		arena_free(a, p, old_size);
+	}
+	return q;
+}
+
+void
+arena_destroy (arena_t *a)
+{
+	if (!a) return;
+	while (a->chunks) {
+		arena_chunk_t *c = a->chunks;
+		a->chunks = c->next;
+		free(c);
+	}
+	free(a);
+}
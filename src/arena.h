@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+# define ARENA_H
+
+#include "defs.h"
+
+arena_t *
+arena_create (void);
+
+void *
+arena_bump (arena_t *a, size_t size);
+
+int
+arena_reserve (arena_t *a, size_t size);
+
+void *
+arena_alloc (arena_t *a, size_t size);
+
+void
+arena_free (arena_t *a, void *p, size_t size);
+
+void *
+arena_realloc (arena_t *a, void *p, size_t old_size, size_t size);
+
+size_t
+arena_size (size_t size);
+
+void
+arena_destroy (arena_t *a);
+
+#endif
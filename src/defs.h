@@ -1,6 +1,96 @@
 #ifndef DEFS_H
 # define DEFS_H
 
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <regex.h>
+
+/* node, edge and name ids, counts and capacities; 32-bit unless built with
+ * -DTOPOLOGIES_64 (make TOPOLOGIES_64=1) for graphs that have more than
+ * INT_MAX nodes or adjacency entries */
+#ifdef TOPOLOGIES_64
+typedef int64_t graph_id_t;
+# define PRI_GRAPH_ID PRId64
+# define GRAPH_ID_MAX INT64_MAX
+#else
+typedef int graph_id_t;
+# define PRI_GRAPH_ID "d"
+# define GRAPH_ID_MAX INT_MAX
+#endif
+
+/* arena */
+
+typedef struct arena_chunk arena_chunk_t;
+
+struct arena_chunk {
+	arena_chunk_t *next;
+	size_t used;
+	size_t cap;
+	char data[];
+};
+
+enum { ARENA_FIRST_CHUNK = 4096 };
+enum { ARENA_CHUNK_SIZE = 1 << 20 };
+enum { ARENA_MIN_BLOCK = 16 };
+enum { ARENA_N_CLASSES = 48 };
+
+typedef struct {
+	arena_chunk_t *chunks;
+	void *free[ARENA_N_CLASSES];
+} arena_t;
+
+/* string pool */
+
+typedef struct {
+	arena_t *mem;
+	char **strs;
+	graph_id_t n_strs;
+	graph_id_t cap_strs;
+	graph_id_t *index;
+	graph_id_t cap_index;
+} str_pool_t;
+
+enum { STR_POOL_BLK_SIZE = 32 };
+
+/* node name pattern: a POSIX basic regular expression searched for in the
+ * full name; a pattern without special characters but a trailing $ is
+ * kept unescaped in literal instead, and compared as a plain string */
+
+typedef struct {
+	regex_t regex;
+	char *literal;
+	size_t len;
+	bool at_end;
+} name_match_t;
+
+/* name trie: a full name is the path of components from the root, joined
+ * by dots; entry 0 is the root and stands for no name at all.  The
+ * children of an entry are listed from first_child through next_sibling,
+ * the last one added first */
+
+typedef struct {
+	graph_id_t parent;
+	graph_id_t comp;
+	int len;
+	graph_id_t first_child;
+	graph_id_t next_sibling;
+} name_entry_t;
+
+typedef struct {
+	str_pool_t *comps;
+	name_entry_t *entries;
+	graph_id_t n_entries;
+	graph_id_t cap_entries;
+	graph_id_t *index;
+	graph_id_t cap_index;
+} name_trie_t;
+
+enum { NAME_TRIE_ROOT = 0 };
+enum { NAME_TRIE_BLK_SIZE = 64 };
+
 /* graph */
 
 typedef enum {
@@ -12,51 +102,187 @@ typedef enum {
 } node_type;
 
 typedef struct {
-	int n;
-	char *attributes;
+	graph_id_t n;
+	int attr;
 } edge_t;
 
+/* adj_set, if not NULL, is an open-addressing multiset of the neighbor ids
+ * in adj, kept for nodes of high degree; the gates <node>._auto[j] for all
+ * j < n_auto are known to be taken */
 typedef struct {
-	char *name;
-	int n;
+	graph_id_t n;
 	edge_t *adj;
-	int n_adj;
-	int cap_adj;
-	node_type type;
-	char *attributes;
+	graph_id_t n_adj;
+	graph_id_t cap_adj;
+	int attr;
+	graph_id_t *adj_set;
+	graph_id_t cap_adj_set;
+	int n_auto;
 } node_t;
 
+/* compressed sparse row adjacency of a frozen graph: neighbors of node i
+ * are adj[offsets[i]] .. adj[offsets[i + 1] - 1], adj_attrs holds the
+ * attribute ids of the corresponding edges */
+typedef struct {
+	graph_id_t *offsets;
+	graph_id_t *adj;
+	int *adj_attrs;
+} graph_csr_t;
+
+/* the names and types of the nodes are kept apart from node_t in arrays
+ * of their own, so that scans by type or name touch only those; bit i of
+ * node_bits is set iff node i is of type NODE_NODE */
 typedef struct {
 	node_t *nodes;
-	int n_nodes;
-	int cap_nodes;
+	graph_id_t *name_ids;
+	unsigned char *types;
+	uint64_t *node_bits;
+	graph_id_t n_nodes;
+	graph_id_t cap_nodes;
+	graph_id_t *index;
+	graph_id_t cap_index;
+	name_trie_t *names;
+	str_pool_t *attrs;
+	graph_csr_t *csr;
+	arena_t *arena;
+	int flags;
+	graph_id_t n_dead;
+	int n_replacing;
 } graph_t;
 
+/* graph_create flags */
+enum {
+	GRAPH_ARENA = 1,
+	GRAPH_ADJ_SET = 2
+};
+
 enum { GRAPH_BLK_SIZE = 32 };
 enum { ADJ_BLK_SIZE = 8 };
+enum { ADJ_SET_MIN_DEGREE = 32 };
+enum { INDEX_INIT_SIZE = 64 };
+
+/* replaced nodes are collected once there are at least VACUUM_MIN_DEAD of
+ * them and they make up more than 1 / VACUUM_DEAD_SHARE of the graph, and
+ * no replacement that holds node ids (n_replacing of them) is expanding */
+enum { VACUUM_MIN_DEAD = 64 };
+enum { VACUUM_DEAD_SHARE = 4 };
+
+/* size of the graph a definition expands to, as counted by the dry run:
+ * n_* are created in any case, max_* are upper bounds that also cover auto
+ * gates, all-match connections and products */
+typedef struct {
+	long n_nodes;
+	long max_nodes;
+	long n_gates;
+	long max_gates;
+	long n_edges;
+	long max_edges;
+} graph_size_t;
+
+/* products: full names of the factors' nodes, attribute ids of the
+ * factors translated to the ones of the product, concatenations are cached
+ * per pair of factor ids */
+
+typedef struct {
+	char **names_a;
+	char **names_b;
+	int *map_a;
+	int *map_b;
+	int *pairs;
+	int n_pairs;
+	int cap_pairs;
+} prod_attrs_t;
 
 /* name stack */
 
-typedef struct name_stack name_stack_t;
+enum { NAME_STACK_BLK_SIZE = 64, NAME_STACK_DEPTH = 16 };
 
-struct name_stack {
-	char *name;
-	name_stack_t *next;
-};
+/* a full name evaluated from template t under the name stack of
+ * generation gen: the index expressions k < n_valid gave values of
+ * version vers[k] of param stack p and end at ends[k] in buf, so that
+ * the next evaluation of t keeps the part of buf they did not change */
+typedef struct {
+	char *buf;
+	size_t cap;
+	struct name_tmpl *t;
+	struct param_stack *p;
+	unsigned long gen;
+	size_t *ends;
+	unsigned long *vers;
+	int n_valid;
+	int cap_exprs;
+} name_buf_t;
+
+/* buf holds the dotted name of the whole stack, starts[k] is the offset
+ * of the k-th entry in it; a separator precedes an entry unless the entry
+ * below it is empty.  gen changes with every enter and leave.  conn_a and
+ * conn_b hold the full names of connection endpoints. */
+typedef struct name_stack {
+	char *buf;
+	size_t len;
+	size_t cap;
+	size_t *starts;
+	int depth;
+	int cap_depth;
+	unsigned long gen;
+	name_buf_t conn_a;
+	name_buf_t conn_b;
+} name_stack_t;
 
 /* param stack */
 
 enum { PARAM_BLK_SIZE = 32 };
 
+/* slot is the expression cache slot of name or -1, prev the entry that
+ * bound the slot before this one or -1; ver identifies the value, which
+ * two bindings share only if the same expression gave both from values
+ * of the same versions */
 typedef struct param {
 	char *name;
 	double value;
+	int slot;
+	int prev;
+	unsigned long ver;
 } param_t;
 
+/* the last value of an expression and its version; the versions of the
+ * values it was computed from are kept in memo_deps */
+typedef struct {
+	double value;
+	unsigned long ver;
+} expr_memo_t;
+
+/* a value read from a binding made outside of a recorded part of the
+ * expansion; a recorder sees the reads of bindings below entry mark */
+typedef struct {
+	int slot;
+	double value;
+} param_read_t;
+
+typedef struct {
+	int mark;
+	param_read_t *reads;
+	int n_reads;
+	int cap_reads;
+} param_rec_t;
+
+/* worker is the thread of the pool the stack belongs to.  The pool is
+ * started for n_threads threads once an array is first cut into tasks. */
 typedef struct param_stack {
 	param_t *params;
 	int n;
 	int cap;
+	struct expr_cache *exprs;
+	unsigned long ver;
+	expr_memo_t *memo;
+	unsigned long *memo_deps;
+	size_t n_memo;
+	param_rec_t *recs;
+	int n_recs;
+	int cap_recs;
+	struct stamp_cache *stamps;
+	struct expand_worker *worker;
+	int n_threads;
 } param_stack_t;
 
 /* network representation */
@@ -68,6 +294,20 @@ typedef struct {
 
 typedef struct connection_wrapper connection_wrapper_t;
 
+/* a connection endpoint split at load time into literal segments and the
+ * index expressions between them: lits[0], exprs[0], "]", lits[1], ...
+ * lits[k] ends with its '[' and is lit_lens[k] chars long; bad is the
+ * offset of an unmatched '[' in name or -1 */
+typedef struct name_tmpl {
+	char *name;
+	char *text;
+	char **lits;
+	size_t *lit_lens;
+	char **exprs;
+	int n_exprs;
+	int bad;
+} name_tmpl_t;
+
 typedef enum {
 	CONN_HAS_CONN,
 	CONN_HAS_LOOP,
@@ -102,6 +342,7 @@ typedef struct {
 	char *end;
 	char *nodes;
 	char *attributes;
+	name_tmpl_t *nodes_tmpl;
 } connection_ring_t;
 
 typedef struct {
@@ -110,6 +351,7 @@ typedef struct {
 	char *end;
 	char *nodes;
 	char *attributes;
+	name_tmpl_t *nodes_tmpl;
 } connection_line_t;
 
 typedef struct {
@@ -118,14 +360,38 @@ typedef struct {
 	char *end;
 	char *nodes;
 	char *attributes;
+	name_tmpl_t *nodes_tmpl;
 } connection_alllist_t;
 
 typedef struct {
 	char *from;
 	char *to;
 	char *attributes;
+	name_tmpl_t *from_tmpl;
+	name_tmpl_t *to_tmpl;
 } connection_plain_t;
 
+/* an endpoint of a connection in a loop whose name has at most one index
+ * that depends on the loop variable, first + k * step at iteration k.
+ * node is the endpoint at iteration 0 and node + k * stride the guess
+ * for iteration k; the guess holds if its name differs from the one of
+ * node only in the component of that index, which is the level-th from
+ * the end, comp at iteration 0, with pre_len chars before the index and
+ * post_len after it.  level is -1 if no index depends on the variable. */
+typedef struct {
+	graph_id_t node;
+	graph_id_t stride;
+	int level;
+	int64_t first;
+	int64_t step;
+	const char *comp;
+	size_t comp_len;
+	size_t pre_len;
+	size_t post_len;
+} conn_affine_t;
+
+enum { CONN_AFFINE_MIN = 4 };
+
 struct connection_wrapper {
 	connection_type_t type;
 	union {
@@ -222,10 +488,214 @@ typedef struct {
 	int n_params;
 } network_t;
 
+/* expression cache: every expression of a definition compiled once, its
+ * variables bound to the slots of values, one per parameter name in
+ * names; slots lists the slots an expression refers to.  scope[k] is the
+ * param stack entry that gives slot k its value, or -1 if the name is
+ * not in scope.  An expression without variables is constant and folded
+ * into value; one that refers to the variable of its innermost loop is
+ * varying, any other has its value remembered between evaluations.  id
+ * numbers the expressions, deps is where the versions of its slots start
+ * in a memo. */
+
+/* integer form of an expression: a stack machine over int64_t that runs
+ * instead of the tree walk while every value stays a small integer */
+
+enum expr_op {
+	EXPR_OP_ADD,
+	EXPR_OP_SUB,
+	EXPR_OP_MUL,
+	EXPR_OP_DIV,
+	EXPR_OP_MOD,
+	EXPR_OP_POW,
+	EXPR_OP_NEG,
+	EXPR_OP_LT,
+	EXPR_OP_LE,
+	EXPR_OP_GT,
+	EXPR_OP_GE,
+	EXPR_OP_EQ,
+	EXPR_OP_NE,
+	EXPR_OP_AND,
+	EXPR_OP_OR,
+	EXPR_OP_NOT,
+	EXPR_OP_NOTNOT,
+	EXPR_OP_NEG_NOT,
+	EXPR_OP_NEG_NOTNOT,
+	EXPR_OP_COMMA,
+	EXPR_OP_FLOOR,
+	EXPR_OP_CEIL,
+	EXPR_OP_ABS,
+	/* the operators above are the tinyexpr functions they stand for */
+	EXPR_OP_N_FUNCS,
+	EXPR_OP_CONST = EXPR_OP_N_FUNCS,
+	EXPR_OP_LOAD,
+	EXPR_OP_FLOORDIV,
+	EXPR_OP_CEILDIV
+};
+
+enum { EXPR_VM_STACK = 16, EXPR_VM_MAX = INT32_MAX };
+
+typedef struct {
+	int op;
+	int64_t arg;
+} expr_insn_t;
+
+/* e is compiled against every name of the definition.  A name that is
+ * also a builtin of tinyexpr means the builtin where it is not bound, so
+ * for the shadows, the slots of such names in str, alts[m] is compiled
+ * without those whose bit in m is clear; e stands for all bits set. */
 typedef struct {
+	char *str;
+	struct te_expr *e;
+	int *shadows;
+	int n_shadows;
+	struct te_expr **alts;
+	int *slots;
+	int n_slots;
+	expr_insn_t *code;
+	int n_code;
+	size_t id;
+	size_t deps;
+	bool constant;
+	bool varying;
+	double value;
+} expr_t;
+
+/* exprs holds what expr_cache_create compiles and is not changed once it
+ * is done (sealed); expressions first looked up later go to more.  A
+ * view of a cache, for another thread, shares exprs, the names and the
+ * trees, whose variables are those of base, and has more, values and
+ * scope of its own.  n_exprs counts the expressions of both tables.
+ * builtins are the slots of the names that are builtins of tinyexpr. */
+typedef struct expr_cache {
+	expr_t *exprs;
+	size_t n_exprs;
+	size_t cap_exprs;
+	expr_t *more;
+	size_t n_more;
+	size_t cap_more;
+	size_t n_deps;
+	str_pool_t *names;
+	double *values;
+	int *scope;
+	struct te_variable *vars;
+	int *builtins;
+	int n_builtins;
+	const void *funcs[EXPR_OP_N_FUNCS];
+	struct expr_cache *base;
+	bool sealed;
+} expr_cache_t;
+
+enum { EXPR_CACHE_INIT_SIZE = 64, EXPR_MAX_SHADOWS = 4 };
+
+/* module instance stamps: the nodes that an instance of module added to
+ * the graph, with the names relative to prefix, the instance name, and
+ * the edges as offsets adj_start[k] .. adj_start[k + 1] - 1 into adj and
+ * adj_attrs, targets relative to the first node.  An instance of the same
+ * module that would read the same values from outside is a copy. */
+typedef struct stamp {
+	module_t *module;
+	param_read_t *reads;
+	int n_reads;
+	graph_id_t prefix;
+	graph_id_t n_nodes;
+	graph_id_t *names;
+	unsigned char *types;
+	int *attrs;
+	graph_id_t *adj_start;
+	graph_id_t *adj;
+	int *adj_attrs;
+	struct stamp *next;
+} stamp_t;
+
+/* state[k] tells if instances of module k may be stamped, stamps[k] lists
+ * the n_stamps[k] stamps of it; they hold for the expansion into g only */
+typedef struct stamp_cache {
+	graph_t *g;
+	struct network_definition *net;
+	stamp_t **stamps;
+	unsigned char *state;
+	int *n_stamps;
+} stamp_cache_t;
+
+enum { STAMP_UNKNOWN, STAMP_VISITING, STAMP_YES, STAMP_NO };
+enum { STAMP_MAX = 16, PARAM_REC_BLK_SIZE = 8 };
+
+/* parallel expansion: the elements of a submodule array are cut into
+ * tasks of consecutive elements.  A task is expanded into a graph of its
+ * own, with the bindings the batch of tasks of the array was made with,
+ * by whichever thread gets to it; res is its error, -1 if it was
+ * skipped after an error of an earlier task.  reads are the values it
+ * read from those bindings. */
+typedef struct expand_task {
+	struct expand_batch *batch;
+	int k;
+	int start;
+	int end;
+	graph_t *g;
+	param_read_t *reads;
+	int n_reads;
+	int res;
+	char *e_text;
+} expand_task_t;
+
+/* failed is the first task that failed, n_tasks while none did */
+typedef struct expand_batch {
+	struct network_definition *net;
+	submodule_plain_t *sm;
+	char *prefix;
+	param_t *params;
+	int n_params;
+	expand_task_t *tasks;
+	int n_tasks;
+	int n_done;
+	int failed;
+	size_t e_size;
+} expand_batch_t;
+
+/* a thread of the pool, with its view of the expression cache, so that
+ * the compiled expressions are shared and the values its own.  Its
+ * deque holds the tasks of the arrays it came across, tasks[top] ..
+ * tasks[bottom - 1]: it takes them from the bottom, the others steal
+ * from the top. */
+typedef struct expand_worker {
+	struct expand_pool *pool;
+	expr_cache_t *exprs;
+	param_stack_t *p;
+	expand_task_t **tasks;
+	int top;
+	int bottom;
+	int cap_tasks;
+	pthread_t thread;
+	bool started;
+} expand_worker_t;
+
+/* worker 0 is the thread that expands the network; lock guards the
+ * deques and the batches, cond is signalled when tasks are added or
+ * done */
+typedef struct expand_pool {
+	struct network_definition *net;
+	expand_worker_t *workers;
+	int n_threads;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+} expand_pool_t;
+
+/* a thread gets about EXPAND_TASKS tasks of an array; a task of simple
+ * modules, which are cheap to expand, has at least EXPAND_SIMPLE_MIN */
+enum {
+	EXPAND_TASKS = 4,
+	EXPAND_SIMPLE_MIN = 16,
+	EXPAND_MAX_THREADS = 256,
+	EXPAND_TASK_BLK_SIZE = 16
+};
+
+typedef struct network_definition {
 	module_t *modules;
 	network_t *network;
 	int n_modules;
+	expr_cache_t *exprs;
 } network_definition_t;
 
 #endif
@@ -16,6 +16,7 @@
 #define TOP_E_REGEX 13
 #define TOP_E_ROOT 14
 #define TOP_E_NODE 15
+#define TOP_E_FROZEN 16
 
 int
 return_error (char *buf, size_t size, int e, const char *errmsg, ...);
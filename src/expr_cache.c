@@ -0,0 +1,657 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "tinyexpr.h"
+
+#include "defs.h"
+#include "expr_cache.h"
+#include "expr_vm.h"
+#include "str_pool.h"
+#include "errors.h"
+
+/* The cache is an open-addressing table of compiled expressions keyed by
+ * the address of their text in the definition, so a lookup never reads
+ * the text itself.  Expressions are compiled against every parameter name
+ * of the definition; the param stack keeps the slots of the names in
+ * scope up to date. */
+static size_t
+expr_hash (const char *str)
+{
+	return ((size_t) str >> 4) * 2654435761u;
+}
+
+static void
+expr_insert (expr_t *exprs, size_t cap_exprs, expr_t *x)
+{
+	size_t i = expr_hash(x->str) & (cap_exprs - 1);
+	while (exprs[i].str)
+		i = (i + 1) & (cap_exprs - 1);
+	exprs[i] = *x;
+}
+
+static int
+expr_cache_grow (expr_t **r_exprs, size_t *r_cap_exprs)
+{
+	size_t cap_exprs = *r_cap_exprs ? 2 * *r_cap_exprs :
+		EXPR_CACHE_INIT_SIZE;
+	expr_t *exprs = (expr_t *) calloc(cap_exprs, sizeof(expr_t));
+	if (!exprs)
+		return TOP_E_ALLOC;
+	for (size_t i = 0; i < *r_cap_exprs; i++)
+		if ((*r_exprs)[i].str)
+			expr_insert(exprs, cap_exprs, &(*r_exprs)[i]);
+	free(*r_exprs);
+	*r_exprs = exprs;
+	*r_cap_exprs = cap_exprs;
+	return 0;
+}
+
+static expr_t *
+expr_find (expr_t *exprs, size_t cap_exprs, char *str)
+{
+	if (!exprs)
+		return NULL;
+	size_t i = expr_hash(str) & (cap_exprs - 1);
+	for (; exprs[i].str; i = (i + 1) & (cap_exprs - 1))
+		if (exprs[i].str == str)
+			return &exprs[i];
+	return NULL;
+}
+
+/* records the slots of the variables n refers to in x */
+static int
+expr_slots (expr_cache_t *c, const te_expr *n, expr_t *x)
+{
+	if (n->type == TE_VARIABLE) {
+		int slot = n->bound - c->values;
+		for (int i = 0; i < x->n_slots; i++)
+			if (x->slots[i] == slot)
+				return 0;
+		int *slots = (int *) realloc(x->slots,
+			(x->n_slots + 1) * sizeof(int));
+		if (!slots)
+			return TOP_E_ALLOC;
+		x->slots = slots;
+		x->slots[x->n_slots++] = slot;
+	} else if (n->type & (TE_FUNCTION0 | TE_CLOSURE0)) {
+		for (int i = 0; i < (n->type & 7); i++) {
+			if (expr_slots(c, n->parameters[i], x))
+				return TOP_E_ALLOC;
+		}
+	}
+	return 0;
+}
+
+/* tells if name is an identifier in str, reading it the way tinyexpr
+ * does, which takes the exponent of a number for part of it */
+static bool
+expr_mentions (const char *str, const char *name)
+{
+	size_t len = strlen(name);
+	const char *s = str;
+	while (*s) {
+		if ((*s >= '0' && *s <= '9') || *s == '.') {
+			char *end;
+			strtod(s, &end);
+			s = (end > s) ? end : s + 1;
+		} else if (*s >= 'a' && *s <= 'z') {
+			const char *start = s;
+			while ((*s >= 'a' && *s <= 'z') || (*s >= '0' && *s <= '9') ||
+				(*s == '_'))
+			{
+				s++;
+			}
+			if (((size_t) (s - start) == len) &&
+				!strncmp(start, name, len))
+			{
+				return true;
+			}
+		} else {
+			s++;
+		}
+	}
+	return false;
+}
+
+/* compiles alts of x, each against the names of o but the shadows whose
+ * bit is clear */
+static int
+expr_compile_alts (expr_cache_t *o, expr_t *x)
+{
+	int n_names = o->names->n_strs;
+	int n_alts = (1 << x->n_shadows) - 1;
+	te_variable *vars = (te_variable *) malloc((n_names + 1) *
+		sizeof(te_variable));
+	x->alts = (te_expr **) calloc(n_alts, sizeof(te_expr *));
+	if (!vars || !x->alts) {
+		free(vars);
+		return TOP_E_ALLOC;
+	}
+	for (int m = 0; m < n_alts; m++) {
+		int n_vars = 0;
+		for (int i = 0; i < n_names; i++) {
+			int k;
+			for (k = 0; k < x->n_shadows; k++)
+				if ((x->shadows[k] == i) && !(m & (1 << k)))
+					break;
+			if (k == x->n_shadows)
+				vars[n_vars++] = o->vars[i];
+		}
+		int err;
+		x->alts[m] = te_compile(x->str, vars, n_vars, &err);
+		if (x->alts[m] && expr_slots(o, x->alts[m], x)) {
+			free(vars);
+			return TOP_E_ALLOC;
+		}
+	}
+	free(vars);
+	return 0;
+}
+
+/* finds the shadows of x and compiles alts for them; more shadows than
+ * EXPR_MAX_SHADOWS are left as plain names */
+static int
+expr_shadow (expr_cache_t *o, expr_t *x)
+{
+	for (int i = 0; i < o->n_builtins; i++) {
+		if (!expr_mentions(x->str, o->names->strs[o->builtins[i]]))
+			continue;
+		if (x->n_shadows == EXPR_MAX_SHADOWS) {
+			x->n_shadows = 0;
+			return 0;
+		}
+		if (!x->shadows && !(x->shadows = (int *) malloc(
+			EXPR_MAX_SHADOWS * sizeof(int))))
+		{
+			return TOP_E_ALLOC;
+		}
+		x->shadows[x->n_shadows++] = o->builtins[i];
+	}
+	return x->n_shadows ? expr_compile_alts(o, x) : 0;
+}
+
+static void
+expr_free (expr_t *x)
+{
+	te_free(x->e);
+	for (int m = 0; x->alts && (m < (1 << x->n_shadows) - 1); m++)
+		te_free(x->alts[m]);
+	free(x->alts);
+	free(x->shadows);
+	free(x->slots);
+	free(x->code);
+}
+
+/* tells if any tree of x compiled */
+static bool
+expr_compiled (const expr_t *x)
+{
+	if (x->e)
+		return true;
+	for (int m = 0; x->alts && (m < (1 << x->n_shadows) - 1); m++)
+		if (x->alts[m])
+			return true;
+	return false;
+}
+
+/* finds the compiled form of str, compiling it on the first lookup.  A
+ * view compiles it against the variables of its base, like the trees it
+ * shares. */
+int
+expr_cache_get (expr_cache_t *c, char *str, expr_t **r_x)
+{
+	expr_t *found = expr_find(c->exprs, c->cap_exprs, str);
+	if (!found)
+		found = expr_find(c->more, c->cap_more, str);
+	if (found) {
+		*r_x = found;
+		return expr_compiled(found) ? 0 : TOP_E_EVAL;
+	}
+
+	/* an expression that does not compile is kept without trees, so
+	 * that it is reported on every evaluation without being parsed
+	 * again */
+	expr_cache_t *o = c->base ? c->base : c;
+	expr_t **table = c->sealed ? &c->more : &c->exprs;
+	size_t *cap = c->sealed ? &c->cap_more : &c->cap_exprs;
+	size_t n = c->sealed ? c->n_more : c->n_exprs;
+	int err;
+	expr_t x = { 0 };
+	x.str = str;
+	x.e = te_compile(str, o->vars, o->names->n_strs, &err);
+	if ((x.e && (expr_slots(o, x.e, &x) || expr_vm_compile(o, &x))) ||
+		expr_shadow(o, &x) ||
+		((2 * (n + 1) > *cap) && expr_cache_grow(table, cap)))
+	{
+		expr_free(&x);
+		return TOP_E_ALLOC;
+	}
+	if (x.e && x.n_slots == 0) {
+		x.constant = true;
+		x.value = te_eval(x.e);
+	}
+	x.id = c->n_exprs;
+	x.deps = c->n_deps;
+	c->n_deps += x.n_slots;
+	expr_insert(*table, *cap, &x);
+	c->n_exprs++;
+	if (c->sealed)
+		c->n_more++;
+	return expr_cache_get(c, str, r_x);
+}
+
+/* tells if every name x refers to is bound but the shadows */
+bool
+expr_cache_bound (expr_cache_t *c, expr_t *x)
+{
+	for (int i = 0; i < x->n_slots; i++) {
+		if (c->scope[x->slots[i]] >= 0)
+			continue;
+		int k;
+		for (k = 0; k < x->n_shadows; k++)
+			if (x->shadows[k] == x->slots[i])
+				break;
+		if (k == x->n_shadows)
+			return false;
+	}
+	return true;
+}
+
+/* writes the value of x, found in c, with the values of c to r; false
+ * if x does not compile with the shadows bound now */
+bool
+expr_cache_eval (expr_cache_t *c, expr_t *x, double *r)
+{
+	te_expr *e = x->e;
+	int m = 0;
+	for (int k = 0; k < x->n_shadows; k++)
+		if (c->scope[x->shadows[k]] >= 0)
+			m |= 1 << k;
+	if (m != (1 << x->n_shadows) - 1) {
+		e = x->alts[m];
+	} else if (x->constant) {
+		*r = x->value;
+		return true;
+	} else if (x->code && expr_vm_eval(x, c->values, r)) {
+		return true;
+	}
+	if (!e)
+		return false;
+	*r = c->base ? expr_vm_walk(e, c->base->values, c->values) :
+		te_eval(e);
+	return true;
+}
+
+/* With compile unset the walk below collects the parameter names, with
+ * compile set it compiles the expressions.  Invalid expressions are not
+ * an error here: modules that are never instantiated may refer to names
+ * defined nowhere, and only evaluating them fails.  inner is the
+ * variable of the innermost loop around an expression: one that refers
+ * to it changes on every evaluation and is not worth remembering. */
+static int
+expr_cache_add (expr_cache_t *c, char *str, char *inner, bool compile,
+	char *e_text, size_t e_size)
+{
+	expr_t *x;
+	if (!str || !compile)
+		return 0;
+	int res = expr_cache_get(c, str, &x);
+	if (res == TOP_E_ALLOC)
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	if (res || !inner)
+		return 0;
+	int slot = str_pool_find(c->names, inner);
+	for (int i = 0; i < x->n_slots; i++)
+		if (x->slots[i] == slot)
+			x->varying = true;
+	return 0;
+}
+
+static int
+expr_cache_add_name (expr_cache_t *c, char *name, bool compile,
+	char *e_text, size_t e_size)
+{
+	if (!name || compile)
+		return 0;
+	if (str_pool_add(c->names, name) < 0)
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	return 0;
+}
+
+static int
+expr_cache_add_params (expr_cache_t *c, raw_param_t *params, int n_params,
+	char *inner, bool compile, char *e_text, size_t e_size)
+{
+	int res;
+	for (int i = 0; i < n_params; i++) {
+		if ((res = expr_cache_add_name(c, params[i].name, compile,
+			e_text, e_size)) ||
+			(res = expr_cache_add(c, params[i].value, inner, compile,
+			e_text, e_size)))
+		{
+			return res;
+		}
+	}
+	return 0;
+}
+
+static int
+expr_cache_add_tmpl (expr_cache_t *c, name_tmpl_t *t, char *inner,
+	bool compile, char *e_text, size_t e_size)
+{
+	int res;
+	if (!t)
+		return 0;
+	for (int i = 0; i < t->n_exprs; i++) {
+		if ((res = expr_cache_add(c, t->exprs[i], inner, compile,
+			e_text, e_size)))
+		{
+			return res;
+		}
+	}
+	return 0;
+}
+
+/* the bounds are evaluated outside the range, the template inside it */
+static int
+expr_cache_add_range (expr_cache_t *c, char *var, char *start, char *end,
+	name_tmpl_t *t, char *inner, bool compile, char *e_text, size_t e_size)
+{
+	int res;
+	if ((res = expr_cache_add_name(c, var, compile, e_text, e_size)) ||
+		(res = expr_cache_add(c, start, inner, compile, e_text,
+		e_size)) ||
+		(res = expr_cache_add(c, end, inner, compile, e_text,
+		e_size)) ||
+		(res = expr_cache_add_tmpl(c, t, var, compile, e_text,
+		e_size)))
+	{
+		return res;
+	}
+	return 0;
+}
+
+static int
+expr_cache_add_connection (expr_cache_t *c, connection_wrapper_t *conn,
+	char *inner, bool compile, char *e_text, size_t e_size)
+{
+	int res;
+	if (!conn)
+		return 0;
+	if (conn->type == CONN_HAS_CONN) {
+		if ((res = expr_cache_add_tmpl(c, conn->ptr.conn->from_tmpl,
+			inner, compile, e_text, e_size)) ||
+			(res = expr_cache_add_tmpl(c, conn->ptr.conn->to_tmpl,
+			inner, compile, e_text, e_size)))
+		{
+			return res;
+		}
+	} else if (conn->type == CONN_HAS_COND) {
+		if ((res = expr_cache_add(c, conn->ptr.cond->condition, inner,
+			compile, e_text, e_size)) ||
+			(res = expr_cache_add_connection(c,
+			conn->ptr.cond->conn_then, inner, compile, e_text,
+			e_size)) ||
+			(res = expr_cache_add_connection(c,
+			conn->ptr.cond->conn_else, inner, compile, e_text,
+			e_size)))
+		{
+			return res;
+		}
+	} else if (conn->type == CONN_HAS_LOOP) {
+		if ((res = expr_cache_add_range(c, conn->ptr.loop->loop,
+			conn->ptr.loop->start, conn->ptr.loop->end, NULL,
+			inner, compile, e_text, e_size)) ||
+			(res = expr_cache_add_connection(c, conn->ptr.loop->conn,
+			conn->ptr.loop->loop, compile, e_text, e_size)))
+		{
+			return res;
+		}
+	} else if (conn->type == CONN_HAS_LINE) {
+		return expr_cache_add_range(c, conn->ptr.line->var,
+			conn->ptr.line->start, conn->ptr.line->end,
+			conn->ptr.line->nodes_tmpl, inner, compile, e_text,
+			e_size);
+	} else if (conn->type == CONN_HAS_RING) {
+		return expr_cache_add_range(c, conn->ptr.ring->var,
+			conn->ptr.ring->start, conn->ptr.ring->end,
+			conn->ptr.ring->nodes_tmpl, inner, compile, e_text,
+			e_size);
+	} else if (conn->type == CONN_HAS_ALLLIST) {
+		return expr_cache_add_range(c, conn->ptr.alllist->var,
+			conn->ptr.alllist->start, conn->ptr.alllist->end,
+			conn->ptr.alllist->nodes_tmpl, inner, compile, e_text,
+			e_size);
+	}
+	return 0;
+}
+
+static int
+expr_cache_add_submodule (expr_cache_t *c, submodule_wrapper_t *s,
+	char *inner, bool compile, char *e_text, size_t e_size)
+{
+	int res;
+	if (!s)
+		return 0;
+	if (s->type == SUBM_HAS_SUBM) {
+		if ((res = expr_cache_add(c, s->ptr.subm->size, inner,
+			compile, e_text, e_size)) ||
+			(res = expr_cache_add_params(c, s->ptr.subm->params,
+			s->ptr.subm->n_params, inner, compile, e_text, e_size)))
+		{
+			return res;
+		}
+	} else if (s->type == SUBM_HAS_PROD) {
+		if ((res = expr_cache_add_submodule(c, s->ptr.prod->a,
+			inner, compile, e_text, e_size)) ||
+			(res = expr_cache_add_submodule(c, s->ptr.prod->b,
+			inner, compile, e_text, e_size)))
+		{
+			return res;
+		}
+	} else if (s->type == SUBM_HAS_COND) {
+		if ((res = expr_cache_add(c, s->ptr.cond->condition, inner,
+			compile, e_text, e_size)) ||
+			(res = expr_cache_add_submodule(c, s->ptr.cond->subm_then,
+			inner, compile, e_text, e_size)) ||
+			(res = expr_cache_add_submodule(c, s->ptr.cond->subm_else,
+			inner, compile, e_text, e_size)))
+		{
+			return res;
+		}
+	}
+	return 0;
+}
+
+/* a module is expanded once for every element of a submodule array, so
+ * for its expressions index is the innermost loop variable */
+static int
+expr_cache_add_definition (expr_cache_t *c, network_definition_t *net,
+	bool compile, char *e_text, size_t e_size)
+{
+	int res;
+	for (int i = 0; i < net->n_modules; i++) {
+		module_t *m = &net->modules[i];
+		if ((res = expr_cache_add_params(c, m->params, m->n_params,
+			"index", compile, e_text, e_size)))
+		{
+			return res;
+		}
+		for (int j = 0; j < m->n_gates; j++) {
+			if ((res = expr_cache_add(c, m->gates[j].size, "index",
+				compile, e_text, e_size)))
+			{
+				return res;
+			}
+		}
+		for (int j = 0; j < m->n_submodules; j++) {
+			if ((res = expr_cache_add_submodule(c, &m->submodules[j],
+				"index", compile, e_text, e_size)))
+			{
+				return res;
+			}
+		}
+		for (int j = 0; j < m->n_connections; j++) {
+			if ((res = expr_cache_add_connection(c,
+				&m->connections[j], "index", compile, e_text,
+				e_size)))
+			{
+				return res;
+			}
+		}
+		for (int j = 0; j < m->n_replace; j++) {
+			if ((res = expr_cache_add_submodule(c,
+				m->replace[j].submodule, "index", compile, e_text,
+				e_size)))
+			{
+				return res;
+			}
+		}
+	}
+	if (net->network) {
+		if ((res = expr_cache_add_params(c, net->network->params,
+			net->network->n_params, NULL, compile, e_text, e_size)))
+		{
+			return res;
+		}
+	}
+	return 0;
+}
+
+/* tinyexpr keeps its builtins private, so a name is taken for one if it
+ * compiles without variables as a constant or called with one or two
+ * arguments */
+static int
+expr_cache_find_builtins (expr_cache_t *c)
+{
+	static const char *probes[] = { "%s", "%s(0)", "%s(0,0)" };
+	c->builtins = (int *) malloc((c->names->n_strs + 1) * sizeof(int));
+	if (!c->builtins)
+		return TOP_E_ALLOC;
+	for (graph_id_t i = 0; i < c->names->n_strs; i++) {
+		char *name = c->names->strs[i];
+		char *probe = (char *) malloc(strlen(name) + 8);
+		if (!probe)
+			return TOP_E_ALLOC;
+		for (int k = 0; k < 3; k++) {
+			int err;
+			sprintf(probe, probes[k], name);
+			te_expr *e = te_compile(probe, NULL, 0, &err);
+			if (e) {
+				te_free(e);
+				c->builtins[c->n_builtins++] = i;
+				break;
+			}
+		}
+		free(probe);
+	}
+	return 0;
+}
+
+/* compiles every expression of net */
+int
+expr_cache_create (network_definition_t *net, expr_cache_t **r_c,
+	char *e_text, size_t e_size)
+{
+	int res;
+	expr_cache_t *c = (expr_cache_t *) calloc(1, sizeof(expr_cache_t));
+	if (!c)
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	c->names = str_pool_create();
+	if (!c->names) {
+		expr_cache_destroy(c);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	/* elements of submodule arrays see their number as index */
+	if (str_pool_add(c->names, "index") < 0 || expr_vm_init(c)) {
+		expr_cache_destroy(c);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	if ((res = expr_cache_add_definition(c, net, false, e_text, e_size))) {
+		expr_cache_destroy(c);
+		return res;
+	}
+
+	graph_id_t n_names = c->names->n_strs;
+	c->values = (double *) calloc(n_names + 1, sizeof(double));
+	c->scope = (int *) malloc((n_names + 1) * sizeof(int));
+	c->vars = (te_variable *) calloc(n_names + 1, sizeof(te_variable));
+	if (!c->values || !c->scope || !c->vars) {
+		expr_cache_destroy(c);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	for (graph_id_t i = 0; i < n_names; i++) {
+		c->vars[i].name = c->names->strs[i];
+		c->vars[i].address = &c->values[i];
+		c->scope[i] = -1;
+	}
+	if (expr_cache_find_builtins(c)) {
+		expr_cache_destroy(c);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+
+	if ((res = expr_cache_add_definition(c, net, true, e_text, e_size))) {
+		expr_cache_destroy(c);
+		return res;
+	}
+	c->sealed = true;
+	*r_c = c;
+	return 0;
+}
+
+/* makes a view of c, with every name unbound */
+expr_cache_t *
+expr_cache_view (expr_cache_t *c)
+{
+	expr_cache_t *o = c->base ? c->base : c;
+	expr_cache_t *v = (expr_cache_t *) calloc(1, sizeof(expr_cache_t));
+	if (!v)
+		return NULL;
+	v->base = o;
+	v->exprs = o->exprs;
+	v->n_exprs = o->n_exprs;
+	v->cap_exprs = o->cap_exprs;
+	v->n_deps = o->n_deps;
+	v->names = o->names;
+	v->sealed = true;
+	graph_id_t n_names = o->names->n_strs;
+	v->values = (double *) calloc(n_names + 1, sizeof(double));
+	v->scope = (int *) malloc((n_names + 1) * sizeof(int));
+	if (!v->values || !v->scope) {
+		expr_cache_destroy(v);
+		return NULL;
+	}
+	for (graph_id_t i = 0; i < n_names; i++)
+		v->scope[i] = -1;
+	return v;
+}
+
+static void
+expr_table_free (expr_t *exprs, size_t cap_exprs)
+{
+	if (!exprs)
+		return;
+	for (size_t i = 0; i < cap_exprs; i++)
+		expr_free(&exprs[i]);
+	free(exprs);
+}
+
+void
+expr_cache_destroy (expr_cache_t *c)
+{
+	if (!c)
+		return;
+	expr_table_free(c->more, c->cap_more);
+	if (!c->base) {
+		expr_table_free(c->exprs, c->cap_exprs);
+		if (c->names)
+			str_pool_destroy(c->names);
+		free(c->vars);
+		free(c->builtins);
+	}
+	free(c->values);
+	free(c->scope);
+	free(c);
+}
@@ -0,0 +1,27 @@
+#ifndef EXPR_CACHE_H
+# define EXPR_CACHE_H
+
+#include <stdbool.h>
+
+#include "defs.h"
+
+int
+expr_cache_create (network_definition_t *net, expr_cache_t **r_c,
+	char *e_text, size_t e_size);
+
+int
+expr_cache_get (expr_cache_t *c, char *str, expr_t **r_x);
+
+bool
+expr_cache_bound (expr_cache_t *c, expr_t *x);
+
+bool
+expr_cache_eval (expr_cache_t *c, expr_t *x, double *r);
+
+expr_cache_t *
+expr_cache_view (expr_cache_t *c);
+
+void
+expr_cache_destroy (expr_cache_t *c);
+
+#endif
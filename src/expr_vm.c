@@ -0,0 +1,386 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "tinyexpr.h"
+
+#include "defs.h"
+#include "expr_vm.h"
+#include "errors.h"
+
+/* Most expressions of a definition are integer index arithmetic.  Those
+ * built only of integer constants, variables and the operators below are
+ * also translated into code for a stack machine over int64_t.  The
+ * machine gives up, and the caller walks the tree instead, as soon as a
+ * value is not an integer of at most EXPR_VM_MAX in magnitude or an
+ * operation would not give one.  Within these bounds every operation of
+ * the tree walk is exact, so both always give the same result. */
+
+static const char *probes[EXPR_OP_N_FUNCS] = {
+	[EXPR_OP_ADD] = "x+x",
+	[EXPR_OP_SUB] = "x-x",
+	[EXPR_OP_MUL] = "x*x",
+	[EXPR_OP_DIV] = "x/x",
+	[EXPR_OP_MOD] = "x%x",
+	[EXPR_OP_POW] = "x^x",
+	[EXPR_OP_NEG] = "-x",
+	[EXPR_OP_LT] = "x<x",
+	[EXPR_OP_LE] = "x<=x",
+	[EXPR_OP_GT] = "x>x",
+	[EXPR_OP_GE] = "x>=x",
+	[EXPR_OP_EQ] = "x==x",
+	[EXPR_OP_NE] = "x!=x",
+	[EXPR_OP_AND] = "x&&x",
+	[EXPR_OP_OR] = "x||x",
+	[EXPR_OP_NOT] = "!x",
+	[EXPR_OP_NOTNOT] = "!!x",
+	[EXPR_OP_NEG_NOT] = "-!x",
+	[EXPR_OP_NEG_NOTNOT] = "-!!x",
+	[EXPR_OP_COMMA] = "x,x",
+	[EXPR_OP_FLOOR] = "floor(x)",
+	[EXPR_OP_CEIL] = "ceil(x)",
+	[EXPR_OP_ABS] = "abs(x)",
+};
+
+/* tinyexpr keeps its operators private, so they are recognized by the
+ * functions it compiles the probes above to */
+int
+expr_vm_init (expr_cache_t *c)
+{
+	double x = 0;
+	te_variable vars[] = { { "x", &x, TE_VARIABLE, NULL } };
+	for (int i = 0; i < EXPR_OP_N_FUNCS; i++) {
+		te_expr *e = te_compile(probes[i], vars, 1, NULL);
+		if (!e)
+			return TOP_E_ALLOC;
+		c->funcs[i] = e->function;
+		te_free(e);
+	}
+	return 0;
+}
+
+static int
+expr_vm_count (const te_expr *n)
+{
+	int count = 1;
+	if (n->type & (TE_FUNCTION0 | TE_CLOSURE0)) {
+		for (int i = 0; i < (n->type & 7); i++)
+			count += expr_vm_count(n->parameters[i]);
+	}
+	return count;
+}
+
+static int
+expr_vm_func (expr_cache_t *c, const te_expr *n)
+{
+	if ((n->type & ~TE_FLAG_PURE) & TE_CLOSURE0)
+		return -1;
+	for (int i = 0; i < EXPR_OP_N_FUNCS; i++)
+		if (c->funcs[i] == n->function)
+			return i;
+	return -1;
+}
+
+/* emits the code of n, whose value ends up at stack position depth */
+static bool
+expr_vm_emit (expr_cache_t *c, const te_expr *n, expr_t *x, int depth)
+{
+	if (depth >= EXPR_VM_STACK)
+		return false;
+	if (n->type == TE_VARIABLE) {
+		x->code[x->n_code].op = EXPR_OP_LOAD;
+		x->code[x->n_code++].arg = n->bound - c->values;
+		return true;
+	}
+	if (!(n->type & (TE_FUNCTION0 | TE_CLOSURE0))) {
+		/* a constant */
+		if (!(n->value >= -EXPR_VM_MAX && n->value <= EXPR_VM_MAX) ||
+			n->value != (int64_t) n->value)
+		{
+			return false;
+		}
+		x->code[x->n_code].op = EXPR_OP_CONST;
+		x->code[x->n_code++].arg = n->value;
+		return true;
+	}
+
+	int op = expr_vm_func(c, n);
+	if (op < 0)
+		return false;
+	const te_expr *a = n->parameters[0];
+	if (op == EXPR_OP_FLOOR || op == EXPR_OP_CEIL) {
+		/* floor(a / b) and ceil(a / b) are integer divisions, while
+		 * of an integer both are the integer itself */
+		if (!(a->type & (TE_FUNCTION0 | TE_CLOSURE0)) ||
+			expr_vm_func(c, a) != EXPR_OP_DIV)
+		{
+			return expr_vm_emit(c, a, x, depth);
+		}
+		if (!expr_vm_emit(c, a->parameters[0], x, depth) ||
+			!expr_vm_emit(c, a->parameters[1], x, depth + 1))
+		{
+			return false;
+		}
+		x->code[x->n_code++].op = (op == EXPR_OP_FLOOR) ?
+			EXPR_OP_FLOORDIV : EXPR_OP_CEILDIV;
+		return true;
+	}
+	for (int i = 0; i < (n->type & 7); i++) {
+		if (!expr_vm_emit(c, n->parameters[i], x, depth + i))
+			return false;
+	}
+	x->code[x->n_code++].op = op;
+	return true;
+}
+
+/* translates x->e; x->code stays NULL if it is not integer arithmetic */
+int
+expr_vm_compile (expr_cache_t *c, expr_t *x)
+{
+	x->code = (expr_insn_t *) malloc(expr_vm_count(x->e) *
+		sizeof(expr_insn_t));
+	if (!x->code)
+		return TOP_E_ALLOC;
+	x->n_code = 0;
+	if (!expr_vm_emit(c, x->e, x, 0)) {
+		free(x->code);
+		x->code = NULL;
+		x->n_code = 0;
+	}
+	return 0;
+}
+
+static bool
+expr_vm_pow (int64_t a, int64_t b, int64_t *r)
+{
+	if (b < 0)
+		return false;
+	if (a == 0 || a == 1) {
+		*r = (b == 0) ? 1 : a;
+		return true;
+	}
+	if (a == -1) {
+		*r = (b % 2) ? -1 : 1;
+		return true;
+	}
+	/* |a| >= 2 leaves the range after at most 31 steps */
+	*r = 1;
+	for (int64_t i = 0; i < b; i++) {
+		*r *= a;
+		if (*r > EXPR_VM_MAX || *r < -EXPR_VM_MAX)
+			return false;
+	}
+	return true;
+}
+
+static const int n_args[] = {
+	[EXPR_OP_ADD] = 2, [EXPR_OP_SUB] = 2, [EXPR_OP_MUL] = 2,
+	[EXPR_OP_DIV] = 2, [EXPR_OP_MOD] = 2, [EXPR_OP_POW] = 2,
+	[EXPR_OP_NEG] = 1,
+	[EXPR_OP_LT] = 2, [EXPR_OP_LE] = 2, [EXPR_OP_GT] = 2,
+	[EXPR_OP_GE] = 2, [EXPR_OP_EQ] = 2, [EXPR_OP_NE] = 2,
+	[EXPR_OP_AND] = 2, [EXPR_OP_OR] = 2,
+	[EXPR_OP_NOT] = 1, [EXPR_OP_NOTNOT] = 1,
+	[EXPR_OP_NEG_NOT] = 1, [EXPR_OP_NEG_NOTNOT] = 1,
+	[EXPR_OP_COMMA] = 2,
+	[EXPR_OP_FLOOR] = 1, [EXPR_OP_CEIL] = 1, [EXPR_OP_ABS] = 1,
+	[EXPR_OP_CONST] = 0, [EXPR_OP_LOAD] = 0,
+	[EXPR_OP_FLOORDIV] = 2, [EXPR_OP_CEILDIV] = 2,
+};
+
+/* applies op to a and b; false if the result would not be an integer
+ * the machine can hold */
+static bool
+expr_vm_op (int op, int64_t a, int64_t b, int64_t *r)
+{
+	int64_t v;
+	switch (op) {
+	case EXPR_OP_ADD: v = a + b; break;
+	case EXPR_OP_SUB: v = a - b; break;
+	case EXPR_OP_MUL: v = a * b; break;
+	case EXPR_OP_DIV:
+		/* only exact quotients are integers */
+		if (b == 0 || a % b)
+			return false;
+		v = a / b;
+		break;
+	case EXPR_OP_MOD:
+		/* fmod, like %, takes the sign of the dividend */
+		if (b == 0)
+			return false;
+		v = a % b;
+		break;
+	case EXPR_OP_POW:
+		if (!expr_vm_pow(a, b, &v))
+			return false;
+		break;
+	case EXPR_OP_NEG: v = -a; break;
+	case EXPR_OP_LT: v = a < b; break;
+	case EXPR_OP_LE: v = a <= b; break;
+	case EXPR_OP_GT: v = a > b; break;
+	case EXPR_OP_GE: v = a >= b; break;
+	case EXPR_OP_EQ: v = a == b; break;
+	case EXPR_OP_NE: v = a != b; break;
+	case EXPR_OP_AND: v = a && b; break;
+	case EXPR_OP_OR: v = a || b; break;
+	case EXPR_OP_NOT: v = !a; break;
+	case EXPR_OP_NOTNOT: v = !!a; break;
+	case EXPR_OP_NEG_NOT: v = -!a; break;
+	case EXPR_OP_NEG_NOTNOT: v = -!!a; break;
+	case EXPR_OP_COMMA: v = b; break;
+	case EXPR_OP_FLOOR:
+	case EXPR_OP_CEIL: v = a; break;
+	case EXPR_OP_ABS: v = (a < 0) ? -a : a; break;
+	case EXPR_OP_FLOORDIV:
+		/* / truncates towards zero */
+		if (b == 0)
+			return false;
+		v = a / b;
+		if (a % b && (a < 0) != (b < 0))
+			v--;
+		break;
+	case EXPR_OP_CEILDIV:
+		if (b == 0)
+			return false;
+		v = a / b;
+		if (a % b && (a < 0) == (b < 0))
+			v++;
+		break;
+	default:
+		return false;
+	}
+	if (v > EXPR_VM_MAX || v < -EXPR_VM_MAX)
+		return false;
+	*r = v;
+	return true;
+}
+
+/* Walks the tree n like te_eval, but reads the variable at from[i] from
+ * values[i]: a view of a cache evaluates the trees of its base.  The
+ * functions of tinyexpr take at most two arguments, and the variables of
+ * a cache are no closures. */
+double
+expr_vm_walk (const te_expr *n, const double *from, const double *values)
+{
+	double a[2];
+	int arity = n->type & 7;
+	if (n->type == TE_VARIABLE)
+		return values[n->bound - from];
+	if (!(n->type & (TE_FUNCTION0 | TE_CLOSURE0)))
+		return n->value;
+	if (((n->type & ~TE_FLAG_PURE) & TE_CLOSURE0) || (arity > 2))
+		return NAN;
+	for (int i = 0; i < arity; i++)
+		a[i] = expr_vm_walk(n->parameters[i], from, values);
+	if (arity == 0)
+		return ((double (*)(void)) n->function)();
+	else if (arity == 1)
+		return ((double (*)(double)) n->function)(a[0]);
+	return ((double (*)(double, double)) n->function)(a[0], a[1]);
+}
+
+static bool
+expr_vm_load (const double *values, int64_t slot, int64_t *r)
+{
+	double d = values[slot];
+	if (!(d >= -EXPR_VM_MAX && d <= EXPR_VM_MAX) || d != (int64_t) d)
+		return false;
+	*r = d;
+	return true;
+}
+
+/* runs the code of x over values; false means the tree walk has to
+ * give the result */
+bool
+expr_vm_eval (const expr_t *x, const double *values, double *r)
+{
+	int64_t st[EXPR_VM_STACK];
+	int sp = 0;
+	for (int i = 0; i < x->n_code; i++) {
+		const expr_insn_t *in = &x->code[i];
+		int64_t a = 0, b = 0;
+		if (in->op == EXPR_OP_CONST) {
+			st[sp++] = in->arg;
+			continue;
+		} else if (in->op == EXPR_OP_LOAD) {
+			if (!expr_vm_load(values, in->arg, &st[sp++]))
+				return false;
+			continue;
+		}
+		if (n_args[in->op] == 2)
+			b = st[--sp];
+		a = st[--sp];
+		if (!expr_vm_op(in->op, a, b, &st[sp++]))
+			return false;
+	}
+	*r = st[0];
+	return true;
+}
+
+/* Finds out if x is an affine function of the variable in slot between
+ * j0 and j1 > j0, all other values given, and writes its values at both
+ * ends.  The code is run once for each end with every value that depends
+ * on the variable kept as a pair; only sums, differences and products
+ * with a value that does not are allowed on pairs.  A value affine in
+ * the variable takes its extremes at the ends, so if no value leaves the
+ * range there, expr_vm_eval gives v0 + (j - j0) * (v1 - v0) / (j1 - j0)
+ * for every j in between. */
+bool
+expr_vm_affine (const expr_t *x, const double *values, int slot,
+	int64_t j0, int64_t j1, int64_t *v0, int64_t *v1)
+{
+	int64_t st0[EXPR_VM_STACK], st1[EXPR_VM_STACK];
+	bool var[EXPR_VM_STACK];
+	int sp = 0;
+	if (!x->code || j0 < -EXPR_VM_MAX || j1 > EXPR_VM_MAX)
+		return false;
+	for (int i = 0; i < x->n_code; i++) {
+		const expr_insn_t *in = &x->code[i];
+		if (in->op == EXPR_OP_CONST) {
+			st0[sp] = st1[sp] = in->arg;
+			var[sp++] = false;
+			continue;
+		} else if (in->op == EXPR_OP_LOAD && in->arg == slot) {
+			st0[sp] = j0;
+			st1[sp] = j1;
+			var[sp++] = true;
+			continue;
+		} else if (in->op == EXPR_OP_LOAD) {
+			if (!expr_vm_load(values, in->arg, &st0[sp]))
+				return false;
+			st1[sp] = st0[sp];
+			var[sp++] = false;
+			continue;
+		}
+		int n = n_args[in->op];
+		sp -= n;
+		int64_t a0 = st0[sp], a1 = st1[sp];
+		int64_t b0 = (n == 2) ? st0[sp + 1] : 0;
+		int64_t b1 = (n == 2) ? st1[sp + 1] : 0;
+		bool var_a = var[sp], var_b = (n == 2) && var[sp + 1];
+		if (!var_a && !var_b) {
+			if (!expr_vm_op(in->op, a0, b0, &st0[sp]))
+				return false;
+			st1[sp] = st0[sp];
+		} else if ((in->op == EXPR_OP_ADD) ||
+			(in->op == EXPR_OP_SUB) ||
+			(in->op == EXPR_OP_NEG) ||
+			(in->op == EXPR_OP_MUL && !(var_a && var_b)) ||
+			(in->op == EXPR_OP_COMMA))
+		{
+			if (!expr_vm_op(in->op, a0, b0, &st0[sp]) ||
+				!expr_vm_op(in->op, a1, b1, &st1[sp]))
+			{
+				return false;
+			}
+			if (in->op == EXPR_OP_COMMA)
+				var_a = false;
+		} else {
+			return false;
+		}
+		var[sp++] = var_a || var_b;
+	}
+	*v0 = st0[0];
+	*v1 = st1[0];
+	return true;
+}
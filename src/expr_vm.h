@@ -0,0 +1,25 @@
+#ifndef EXPR_VM_H
+# define EXPR_VM_H
+
+#include <stdbool.h>
+
+#include "defs.h"
+
+int
+expr_vm_init (expr_cache_t *c);
+
+int
+expr_vm_compile (expr_cache_t *c, expr_t *x);
+
+bool
+expr_vm_eval (const expr_t *x, const double *values, double *r);
+
+double
+expr_vm_walk (const struct te_expr *n, const double *from,
+	const double *values);
+
+bool
+expr_vm_affine (const expr_t *x, const double *values, int slot,
+	int64_t j0, int64_t j1, int64_t *v0, int64_t *v1);
+
+#endif
@@ -4,213 +4,842 @@
 #include <string.h>
 
 #include "graph.h"
+#include "str_pool.h"
+#include "name_trie.h"
+#include "arena.h"
 #include "topologies.h"
 #include "defs.h"
 #include "errors.h"
 
+#define NODE_BITS_WORDS(n) (((size_t) (n) + 63) / 64)
+
+/* The index is an open-addressing table of node ids keyed by the trie id
+ * of the node name.
+ * Nodes are never removed from it: replaced nodes stay in their slots and
+ * are skipped on lookup, so probe chains remain intact.  Since ids are
+ * inserted in increasing order, a probe sequence meets nodes sharing a
+ * name in the order they were added. */
+static size_t
+graph_index_hash (graph_id_t name)
+{
+	return (size_t) name * 2654435761u;
+}
+
+static void
+graph_index_insert (graph_id_t *index, graph_id_t cap_index, graph_id_t name,
+	graph_id_t n)
+{
+	size_t i = graph_index_hash(name) & (cap_index - 1);
+	while (index[i] >= 0)
+		i = (i + 1) & (cap_index - 1);
+	index[i] = n;
+}
+
+static int
+graph_index_grow (graph_t *g, graph_id_t cap_index)
+{
+	graph_id_t *index = (graph_id_t *) malloc(cap_index *
+		sizeof(graph_id_t));
+	if (!index)
+		return TOP_E_ALLOC;
+	memset(index, -1, cap_index * sizeof(graph_id_t));
+	for (graph_id_t i = 0; i < g->n_nodes; i++)
+		graph_index_insert(index, cap_index, g->name_ids[i], i);
+	free(g->index);
+	g->index = index;
+	g->cap_index = cap_index;
+	return 0;
+}
+
+static void *
+graph_realloc (graph_t *g, void *p, size_t old_size, size_t size)
+{
+	if (g->arena)
+		return arena_realloc(g->arena, p, old_size, size);
+	return realloc(p, size);
+}
+
+/* grows the node array and the per-node arrays beside it to cap_nodes */
+static int
+graph_nodes_grow (graph_t *g, graph_id_t cap_nodes)
+{
+	node_t *nodes = (node_t *) graph_realloc(g, g->nodes,
+		g->cap_nodes * sizeof(node_t), cap_nodes * sizeof(node_t));
+	if (!nodes)
+		return TOP_E_ALLOC;
+	memset(nodes + g->cap_nodes, 0,
+		(cap_nodes - g->cap_nodes) * sizeof(node_t));
+	g->nodes = nodes;
+
+	graph_id_t *name_ids = (graph_id_t *) realloc(g->name_ids,
+		cap_nodes * sizeof(graph_id_t));
+	if (!name_ids)
+		return TOP_E_ALLOC;
+	g->name_ids = name_ids;
+	unsigned char *types = (unsigned char *) realloc(g->types, cap_nodes);
+	if (!types)
+		return TOP_E_ALLOC;
+	g->types = types;
+
+	size_t n_words = NODE_BITS_WORDS(g->cap_nodes);
+	size_t cap_words = NODE_BITS_WORDS(cap_nodes);
+	uint64_t *node_bits = (uint64_t *) realloc(g->node_bits,
+		cap_words * sizeof(uint64_t));
+	if (!node_bits)
+		return TOP_E_ALLOC;
+	memset(node_bits + n_words, 0, (cap_words - n_words) * sizeof(uint64_t));
+	g->node_bits = node_bits;
+	g->cap_nodes = cap_nodes;
+	return 0;
+}
+
+/* With GRAPH_ARENA the node array and the adjacency lists are carved from
+ * an arena owned by the graph, outgrown blocks are recycled through its
+ * free lists and destroying the graph releases everything at once.
+ * With GRAPH_ADJ_SET nodes of degree ADJ_SET_MIN_DEGREE and above get a
+ * hash set of their neighbors, so that adjacency tests stay O(1). */
 graph_t *
-graph_create (void)
+graph_create (int flags)
 {
-	graph_t *g = (graph_t *) malloc(sizeof(graph_t));
+	graph_t *g = (graph_t *) calloc(1, sizeof(graph_t));
 	if (!g)
 		return NULL;
+	g->flags = flags;
+	if (flags & GRAPH_ARENA) {
+		g->arena = arena_create();
+		if (!g->arena) {
+			free(g);
+			return NULL;
+		}
+	}
 	g->n_nodes = 0;
-	g->cap_nodes = GRAPH_BLK_SIZE;
-	g->nodes = (node_t *) calloc(g->cap_nodes, sizeof(node_t));
-	if (!g->nodes) {
-		free(g);
+	g->cap_index = INDEX_INIT_SIZE;
+	g->index = (graph_id_t *) malloc(g->cap_index * sizeof(graph_id_t));
+	g->names = name_trie_create();
+	g->attrs = str_pool_create();
+	if (graph_nodes_grow(g, GRAPH_BLK_SIZE) ||
+		!g->index || !g->names || !g->attrs)
+	{
+		topologies_graph_destroy(g);
 		return NULL;
 	}
+	memset(g->index, -1, g->cap_index * sizeof(graph_id_t));
+	g->csr = NULL;
 	return g;
 }
 
+static size_t
+adj_set_hash (graph_id_t n)
+{
+	return (size_t) n * 2654435761u;
+}
+
+static void
+adj_set_insert (graph_id_t *set, graph_id_t cap, graph_id_t n)
+{
+	size_t k = adj_set_hash(n) & (cap - 1);
+	while (set[k] >= 0)
+		k = (k + 1) & (cap - 1);
+	set[k] = n;
+}
+
+static void
+adj_set_remove (graph_id_t *set, graph_id_t cap, graph_id_t n)
+{
+	size_t k = adj_set_hash(n) & (cap - 1);
+	while (set[k] != n) {
+		if (set[k] < 0)
+			return;
+		k = (k + 1) & (cap - 1);
+	}
+	/* shift the rest of the cluster back over the hole */
+	size_t hole = k;
+	for (k = (k + 1) & (cap - 1); set[k] >= 0; k = (k + 1) & (cap - 1)) {
+		size_t home = adj_set_hash(set[k]) & (cap - 1);
+		if (((k - home) & (cap - 1)) >= ((k - hole) & (cap - 1))) {
+			set[hole] = set[k];
+			hole = k;
+		}
+	}
+	set[hole] = -1;
+}
+
+static int
+adj_set_rebuild (graph_t *g, node_t *node)
+{
+	graph_id_t cap = ADJ_SET_MIN_DEGREE;
+	while (cap < 4 * node->n_adj)
+		cap *= 2;
+	graph_id_t *set = (graph_id_t *) graph_realloc(g, NULL, 0,
+		cap * sizeof(graph_id_t));
+	if (!set)
+		return TOP_E_ALLOC;
+	memset(set, -1, cap * sizeof(graph_id_t));
+	for (graph_id_t j = 0; j < node->n_adj; j++)
+		adj_set_insert(set, cap, node->adj[j].n);
+	if (g->arena)
+		arena_free(g->arena, node->adj_set,
+			node->cap_adj_set * sizeof(graph_id_t));
+	else
+		free(node->adj_set);
+	node->adj_set = set;
+	node->cap_adj_set = cap;
+	return 0;
+}
+
+/* a frozen graph is looked up in its CSR layout */
+bool
+graph_adj_has (graph_t *g, node_t *node, graph_id_t n)
+{
+	if (g->csr) {
+		graph_id_t i = node - g->nodes;
+		for (graph_id_t k = g->csr->offsets[i];
+			k < g->csr->offsets[i + 1]; k++)
+		{
+			if (g->csr->adj[k] == n)
+				return true;
+		}
+		return false;
+	}
+	if (node->adj_set) {
+		graph_id_t cap = node->cap_adj_set;
+		size_t k = adj_set_hash(n) & (cap - 1);
+		for (; node->adj_set[k] >= 0; k = (k + 1) & (cap - 1))
+			if (node->adj_set[k] == n)
+				return true;
+		return false;
+	}
+	for (graph_id_t j = 0; j < node->n_adj; j++)
+		if (node->adj[j].n == n)
+			return true;
+	return false;
+}
+
+/* appends n to the adjacency list of node, newly allocated slots are
+ * zeroed */
 int
-graph_add_node (graph_t *g, char *name, node_type type, char *attrs)
-{
-	int i = g->n_nodes;
-	if (g->n_nodes == g->cap_nodes) {
-		g->cap_nodes += GRAPH_BLK_SIZE;
-		g->nodes = (node_t *) realloc(g->nodes,
-			g->cap_nodes * sizeof(node_t));
-		if (!g->nodes)
+graph_adj_push (graph_t *g, node_t *node, graph_id_t n, int attr)
+{
+	if (g->csr)
+		return TOP_E_FROZEN;
+	if (node->n_adj == node->cap_adj) {
+		graph_id_t cap_adj = g->arena ? 2 * node->cap_adj :
+			node->cap_adj + ADJ_BLK_SIZE;
+		edge_t *adj = (edge_t *) graph_realloc(g, node->adj,
+			node->cap_adj * sizeof(edge_t), cap_adj * sizeof(edge_t));
+		if (!adj)
 			return TOP_E_ALLOC;
-		memset(g->nodes + (g->cap_nodes - GRAPH_BLK_SIZE), 0,
-			GRAPH_BLK_SIZE * sizeof(node_t));
+		memset(adj + node->cap_adj, 0,
+			(cap_adj - node->cap_adj) * sizeof(edge_t));
+		node->adj = adj;
+		node->cap_adj = cap_adj;
 	}
-	g->nodes[i].name = (char *) malloc(strlen(name) + 1);
-	if (!g->nodes[i].name)
+	node->adj[node->n_adj].n = n;
+	node->adj[node->n_adj].attr = attr;
+	node->n_adj++;
+
+	if (node->adj_set && (2 * node->n_adj <= node->cap_adj_set)) {
+		adj_set_insert(node->adj_set, node->cap_adj_set, n);
+	} else if ((g->flags & GRAPH_ADJ_SET) &&
+		(node->n_adj >= ADJ_SET_MIN_DEGREE))
+	{
+		return adj_set_rebuild(g, node);
+	}
+	return 0;
+}
+
+/* points the j-th edge of node at n instead; the node of a frozen graph
+ * has no list to change */
+void
+graph_adj_set_n (node_t *node, graph_id_t j, graph_id_t n)
+{
+	if (!node->adj)
+		return;
+	if (node->adj_set) {
+		adj_set_remove(node->adj_set, node->cap_adj_set,
+			node->adj[j].n);
+		adj_set_insert(node->adj_set, node->cap_adj_set, n);
+	}
+	node->adj[j].n = n;
+}
+
+void
+graph_adj_clear (node_t *node)
+{
+	if (!node->adj)
+		return;
+	if (node->adj_set)
+		memset(node->adj_set, -1, node->cap_adj_set * sizeof(graph_id_t));
+	node->n_adj = 0;
+}
+
+/* interns an attribute string; ids start from 1, so that zeroed edges and
+ * NULL attributes both map to the id 0 meaning "no attributes" */
+int
+graph_attr_id (graph_t *g, char *attrs, int *r_attr)
+{
+	*r_attr = 0;
+	if (!attrs)
+		return 0;
+	if ((*r_attr = str_pool_add(g->attrs, attrs) + 1) == 0)
 		return TOP_E_ALLOC;
-	strncpy(g->nodes[i].name, name, strlen(name) + 1);
-	g->nodes[i].adj = (edge_t *) malloc(ADJ_BLK_SIZE * sizeof(edge_t));
-	memset(g->nodes[i].adj, 0, ADJ_BLK_SIZE * sizeof(edge_t));
+	return 0;
+}
+
+char *
+graph_attr (graph_t *g, int attr)
+{
+	return (attr == 0) ? NULL : g->attrs->strs[attr - 1];
+}
+
+/* sets the type of node n, keeping node_bits in step */
+void
+graph_set_type (graph_t *g, graph_id_t n, node_type type)
+{
+	uint64_t bit = (uint64_t) 1 << (n % 64);
+	if (type == NODE_NODE)
+		g->node_bits[n / 64] |= bit;
+	else
+		g->node_bits[n / 64] &= ~bit;
+	g->types[n] = type;
+}
+
+/* returns the first node of type NODE_NODE at or after n, or n_nodes if
+ * there is none; whole words of gates and replaced nodes are skipped */
+graph_id_t
+graph_next_node (graph_t *g, graph_id_t n)
+{
+	if (n >= g->n_nodes)
+		return g->n_nodes;
+	size_t w = n / 64;
+	size_t n_words = NODE_BITS_WORDS(g->n_nodes);
+	uint64_t bits = g->node_bits[w] & (~(uint64_t) 0 << (n % 64));
+	while (!bits) {
+		if (++w == n_words)
+			return g->n_nodes;
+		bits = g->node_bits[w];
+	}
+	return (graph_id_t) (w * 64 + __builtin_ctzll(bits));
+}
+
+/* returns the number of nodes of type NODE_NODE */
+graph_id_t
+graph_count_nodes (graph_t *g)
+{
+	graph_id_t count = 0;
+	for (size_t w = 0; w < NODE_BITS_WORDS(g->n_nodes); w++)
+		count += __builtin_popcountll(g->node_bits[w]);
+	return count;
+}
+
+/* adds a node named by an id of the graph's name trie */
+int
+graph_add_node_id (graph_t *g, graph_id_t name, node_type type, int attr)
+{
+	graph_id_t i = g->n_nodes;
+	if (g->csr)
+		return TOP_E_FROZEN;
+	if (2 * (g->n_nodes + 1) > g->cap_index) {
+		if (graph_index_grow(g, 2 * g->cap_index))
+			return TOP_E_ALLOC;
+	}
+	if ((g->n_nodes == g->cap_nodes) && graph_nodes_grow(g, g->arena ?
+		2 * g->cap_nodes : g->cap_nodes + GRAPH_BLK_SIZE))
+			return TOP_E_ALLOC;
+	g->name_ids[i] = name;
+	g->nodes[i].adj = (edge_t *) graph_realloc(g, NULL, 0,
+		ADJ_BLK_SIZE * sizeof(edge_t));
 	if (!g->nodes[i].adj)
 		return TOP_E_ALLOC;
+	memset(g->nodes[i].adj, 0, ADJ_BLK_SIZE * sizeof(edge_t));
 	g->nodes[i].n_adj = 0;
 	g->nodes[i].cap_adj = ADJ_BLK_SIZE;
 	g->nodes[i].n = i;
-	g->nodes[i].type = type;
-	if (attrs) {
-		char *node_attrs = malloc(strlen(attrs) + 1);
-		if (!node_attrs)
-			return TOP_E_ALLOC;
-		strncpy(node_attrs, attrs, strlen(attrs) + 1);
-		g->nodes[i].attributes = node_attrs;
-	} else {
-		g->nodes[i].attributes = NULL;
-	}
+	g->nodes[i].n_auto = 0;
+	g->types[i] = NODE_REPLACED;
+	graph_set_type(g, i, type);
+	g->nodes[i].attr = attr;
+	graph_index_insert(g->index, g->cap_index, name, i);
 	g->n_nodes++;
 	return 0;
 }
 
 int
-graph_find_node (graph_t *g, char *name)
+graph_add_node (graph_t *g, char *name, node_type type, int attr)
 {
-	for (int i = 0; i < g->n_nodes; i++)
-		if ((strcmp(g->nodes[i].name, name) == 0) &&
-			(g->nodes[i].type != NODE_REPLACED) &&
-			(g->nodes[i].type != NODE_REPLACED_T))
-				return i;
-	return -1;
+	graph_id_t name_id = name_trie_add(g->names, name);
+	if (name_id < 0)
+		return TOP_E_ALLOC;
+	return graph_add_node_id(g, name_id, type, attr);
 }
 
+/* writes the full name of node n to *buf of *cap chars, growing it if
+ * needed; returns *buf or NULL if out of memory */
+char *
+graph_node_name (graph_t *g, graph_id_t n, char **buf, size_t *cap)
+{
+	return name_trie_name(g->names, g->name_ids[n], buf, cap);
+}
+
+/* preallocates room for n_nodes nodes and n_edges edges in total, so that
+ * a graph of known size is built without growing its arrays */
 int
-graph_add_edge_id (graph_t *g, int n_a, int n_b, char *attrs)
+graph_reserve (graph_t *g, graph_id_t n_nodes, graph_id_t n_edges)
 {
-	if ((n_a < 0) || (n_b < 0) || (n_a == n_b) || (n_a > g->n_nodes) || (n_b > g->n_nodes))
-		return TOP_E_CONN;
-	for (int i = 0; i < g->nodes[n_a].n_adj; i++)
-		if (g->nodes[n_a].adj[i].n == n_b)
-			return 0;
-
-	node_t *node_a = &(g->nodes[n_a]);
-	node_t *node_b = &(g->nodes[n_b]);
-	int i = node_a->n_adj;
-	if (node_a->n_adj == node_a->cap_adj) {
-		node_a->cap_adj += ADJ_BLK_SIZE;
-		node_a->adj = (edge_t *) realloc(node_a->adj,
-			node_a->cap_adj * sizeof(edge_t));
-		if (!node_a->adj)
-			return TOP_E_ALLOC;
-		memset(node_a->adj + (node_a->cap_adj - ADJ_BLK_SIZE), 0,
-			ADJ_BLK_SIZE * sizeof(edge_t));
-	}
-	node_a->adj[i].n = node_b->n;
-	node_a->adj[i].attributes = NULL;
-	if (attrs) {
-		node_a->adj[i].attributes = (char *) malloc(strlen(attrs) + 1);
-		if (!node_a->adj[i].attributes)
+	graph_id_t cap_index = g->cap_index;
+	while (2 * n_nodes > cap_index)
+		cap_index *= 2;
+	if ((cap_index > g->cap_index) && graph_index_grow(g, cap_index))
+		return TOP_E_ALLOC;
+	if (name_trie_reserve(g->names, n_nodes))
+		return TOP_E_ALLOC;
+	if ((n_nodes > g->cap_nodes) && graph_nodes_grow(g, n_nodes))
+		return TOP_E_ALLOC;
+	if (g->arena) {
+		/* every node starts with ADJ_BLK_SIZE slots, edges past
+		 * that are spread over the high-degree nodes */
+		size_t n_slots = 0;
+		if (n_nodes > g->n_nodes)
+			n_slots = (size_t) (n_nodes - g->n_nodes) * ADJ_BLK_SIZE;
+		if ((size_t) 2 * n_edges > n_slots)
+			n_slots = (size_t) 2 * n_edges;
+		if (n_slots && arena_reserve(g->arena, n_slots * sizeof(edge_t)))
 			return TOP_E_ALLOC;
-		strncpy(node_a->adj[i].attributes, attrs, strlen(attrs) + 1);
 	}
-	node_a->n_adj++;
+	return 0;
+}
 
-	i = node_b->n_adj;
-	if (node_b->n_adj == node_b->cap_adj) {
-		node_b->cap_adj += ADJ_BLK_SIZE;
-		node_b->adj = (edge_t *) realloc(node_b->adj,
-			node_b->cap_adj * sizeof(edge_t));
-		if (!node_b->adj)
-			return TOP_E_ALLOC;
-		memset(node_b->adj + (node_b->cap_adj - ADJ_BLK_SIZE), 0,
-			ADJ_BLK_SIZE * sizeof(edge_t));
-	}
-	node_b->adj[i].n = node_a->n;
-	node_b->adj[i].attributes = NULL;
-	if (attrs) {
-		node_b->adj[i].attributes = (char *) malloc(strlen(attrs) + 1);
-		if (!node_b->adj[i].attributes)
+static void
+graph_node_free (graph_t *g, node_t *node)
+{
+	if (g->arena) {
+		arena_free(g->arena, node->adj, node->cap_adj * sizeof(edge_t));
+		arena_free(g->arena, node->adj_set,
+			node->cap_adj_set * sizeof(graph_id_t));
+	} else {
+		free(node->adj);
+		free(node->adj_set);
+	}
+}
+
+/* Drops the replaced nodes no edge points to and renumbers the others in
+ * one pass, keeping their order, so lookups by name still find the same
+ * nodes.  Node ids held by the caller are invalidated. */
+int
+graph_vacuum (graph_t *g)
+{
+	if (g->csr)
+		return TOP_E_FROZEN;
+	graph_id_t *map = (graph_id_t *) calloc(g->n_nodes + 1,
+		sizeof(graph_id_t));
+	if (!map)
+		return TOP_E_ALLOC;
+	for (graph_id_t i = 0; i < g->n_nodes; i++)
+		for (graph_id_t j = 0; j < g->nodes[i].n_adj; j++)
+			map[g->nodes[i].adj[j].n] = 1;
+
+	graph_id_t n = 0;
+	for (graph_id_t i = 0; i < g->n_nodes; i++) {
+		if ((g->types[i] == NODE_REPLACED) &&
+			(g->nodes[i].n_adj == 0) && !map[i])
+		{
+			graph_node_free(g, &g->nodes[i]);
+			map[i] = -1;
+			continue;
+		}
+		map[i] = n;
+		if (n != i) {
+			g->nodes[n] = g->nodes[i];
+			g->name_ids[n] = g->name_ids[i];
+			g->types[n] = g->types[i];
+		}
+		g->nodes[n].n = n;
+		g->nodes[n].n_auto = 0;
+		n++;
+	}
+	memset(g->nodes + n, 0, (g->n_nodes - n) * sizeof(node_t));
+	memset(g->node_bits, 0,
+		NODE_BITS_WORDS(g->n_nodes) * sizeof(uint64_t));
+	g->n_nodes = n;
+	for (graph_id_t i = 0; i < g->n_nodes; i++)
+		if (g->types[i] == NODE_NODE)
+			g->node_bits[i / 64] |= (uint64_t) 1 << (i % 64);
+
+	for (graph_id_t i = 0; i < g->n_nodes; i++) {
+		node_t *node = &g->nodes[i];
+		for (graph_id_t j = 0; j < node->n_adj; j++)
+			node->adj[j].n = map[node->adj[j].n];
+		if (node->adj_set && adj_set_rebuild(g, node)) {
+			free(map);
 			return TOP_E_ALLOC;
-		strncpy(node_b->adj[i].attributes, attrs, strlen(attrs) + 1);
+		}
 	}
-	node_b->n_adj++;
+	free(map);
 
+	memset(g->index, -1, g->cap_index * sizeof(graph_id_t));
+	for (graph_id_t i = 0; i < g->n_nodes; i++)
+		graph_index_insert(g->index, g->cap_index, g->name_ids[i], i);
+	g->n_dead = 0;
 	return 0;
 }
 
+graph_id_t
+graph_find_node_id (graph_t *g, graph_id_t name)
+{
+	size_t i = graph_index_hash(name) & (g->cap_index - 1);
+	for (; g->index[i] >= 0; i = (i + 1) & (g->cap_index - 1)) {
+		graph_id_t n = g->index[i];
+		if ((g->types[n] != NODE_REPLACED) &&
+			(g->types[n] != NODE_REPLACED_T) &&
+			(g->name_ids[n] == name))
+				return n;
+	}
+	return -1;
+}
+
+/* tells if any node, replaced ones included, is named name */
 bool
-graph_are_adjacent (node_t *node_a, node_t *node_b)
+graph_name_used (graph_t *g, graph_id_t name)
 {
-	if (!node_a || !node_b) return false;
-	for (int j = 0; j < node_a->n_adj; j++) {
-		if (node_a->adj[j].n == node_b->n)
+	size_t i = graph_index_hash(name) & (g->cap_index - 1);
+	for (; g->index[i] >= 0; i = (i + 1) & (g->cap_index - 1)) {
+		if (g->name_ids[g->index[i]] == name)
 			return true;
 	}
 	return false;
 }
 
+static int
+graph_id_cmp (const void *a, const void *b)
+{
+	graph_id_t x = *(const graph_id_t *) a;
+	graph_id_t y = *(const graph_id_t *) b;
+	return (x > y) - (x < y);
+}
+
+/* sets *r_ids to the ids of the nodes that are not replaced and whose full
+ * names start with the string prefix, in increasing order; only the names
+ * under the prefix are looked at.  The caller frees *r_ids */
 int
-graph_add_edge_name (graph_t *g, char *name_a, char *name_b, char *attrs)
+graph_select_prefixed (graph_t *g, const char *prefix, graph_id_t **r_ids,
+	graph_id_t *r_n)
 {
-	int node_a, node_b;
+	graph_id_t *names;
+	graph_id_t n_names;
+	if (name_trie_prefixed(g->names, prefix, &names, &n_names))
+		return TOP_E_ALLOC;
+	graph_id_t n = 0, cap = n_names + 1;
+	graph_id_t *ids = (graph_id_t *) malloc(cap * sizeof(graph_id_t));
+	if (!ids) {
+		free(names);
+		return TOP_E_ALLOC;
+	}
+	for (graph_id_t k = 0; k < n_names; k++) {
+		size_t i = graph_index_hash(names[k]) & (g->cap_index - 1);
+		for (; g->index[i] >= 0; i = (i + 1) & (g->cap_index - 1)) {
+			graph_id_t node = g->index[i];
+			if ((g->name_ids[node] != names[k]) ||
+				(g->types[node] == NODE_REPLACED) ||
+				(g->types[node] == NODE_REPLACED_T))
+			{
+				continue;
+			}
+			if (n == cap) {
+				graph_id_t *new_ids = (graph_id_t *) realloc(ids,
+					2 * cap * sizeof(graph_id_t));
+				if (!new_ids) {
+					free(ids);
+					free(names);
+					return TOP_E_ALLOC;
+				}
+				ids = new_ids;
+				cap *= 2;
+			}
+			ids[n++] = node;
+		}
+	}
+	free(names);
+	qsort(ids, n, sizeof(graph_id_t), graph_id_cmp);
+	*r_ids = ids;
+	*r_n = n;
+	return 0;
+}
+
+graph_id_t
+graph_find_node (graph_t *g, char *name)
+{
+	graph_id_t name_id = name_trie_find(g->names, name);
+	if (name_id < 0)
+		return -1;
+	return graph_find_node_id(g, name_id);
+}
+
+int
+graph_add_edge_id (graph_t *g, graph_id_t n_a, graph_id_t n_b, int attr)
+{
+	if ((n_a < 0) || (n_b < 0) || (n_a == n_b) ||
+		(n_a >= g->n_nodes) || (n_b >= g->n_nodes))
+	{
+		return TOP_E_CONN;
+	}
+	if (g->csr)
+		return TOP_E_FROZEN;
+	if (graph_adj_has(g, &g->nodes[n_a], n_b))
+		return 0;
+
+	int res;
+	if ((res = graph_adj_push(g, &g->nodes[n_a], n_b, attr)))
+		return res;
+	return graph_adj_push(g, &g->nodes[n_b], n_a, attr);
+}
+
+bool
+graph_are_adjacent (graph_t *g, node_t *node_a, node_t *node_b)
+{
+	if (!node_a || !node_b) return false;
+	return graph_adj_has(g, node_a, node_b->n);
+}
+
+int
+graph_add_edge_name (graph_t *g, char *name_a, char *name_b, int attr)
+{
+	graph_id_t node_a, node_b;
 	node_a = graph_find_node(g, name_a);
 	node_b = graph_find_node(g, name_b);
 	if (node_a < 0)
 		return TOP_E_CONN;
 	if (node_b < 0)
 		return TOP_E_CONN;
-	return graph_add_edge_id(g, node_a, node_b, attrs);
+	return graph_add_edge_id(g, node_a, node_b, attr);
+}
+
+/* interns the names and attributes of src in g, comps, names and attrs
+ * map the ids of src to the ones of g */
+static int
+graph_append_map (graph_t *g, graph_t *src, graph_id_t *comps,
+	graph_id_t *names, int *attrs)
+{
+	name_trie_t *t = src->names;
+	for (graph_id_t c = 0; c < t->comps->n_strs; c++) {
+		if ((comps[c] = str_pool_add(g->names->comps,
+			t->comps->strs[c])) < 0)
+		{
+			return TOP_E_ALLOC;
+		}
+	}
+	/* an entry is added after its parent, so the parents of the entries
+	 * are mapped before them */
+	names[NAME_TRIE_ROOT] = NAME_TRIE_ROOT;
+	for (graph_id_t e = NAME_TRIE_ROOT + 1; e < t->n_entries; e++) {
+		if ((names[e] = name_trie_child_id(g->names,
+			names[t->entries[e].parent],
+			comps[t->entries[e].comp], true)) < 0)
+		{
+			return TOP_E_ALLOC;
+		}
+	}
+	attrs[0] = 0;
+	for (graph_id_t i = 0; i < src->attrs->n_strs; i++) {
+		if (graph_attr_id(g, src->attrs->strs[i], &attrs[i + 1]))
+			return TOP_E_ALLOC;
+	}
+	return 0;
+}
+
+/* appends the nodes of src to g in their order, with their edges, the
+ * ids of both ends moved by the number of nodes g had */
+int
+graph_append (graph_t *g, graph_t *src)
+{
+	int res;
+	graph_id_t base = g->n_nodes;
+	if (g->csr)
+		return TOP_E_FROZEN;
+	graph_id_t *comps = (graph_id_t *) malloc(
+		(src->names->comps->n_strs + 1) * sizeof(graph_id_t));
+	graph_id_t *names = (graph_id_t *) malloc(src->names->n_entries *
+		sizeof(graph_id_t));
+	int *attrs = (int *) malloc((src->attrs->n_strs + 1) * sizeof(int));
+	if (!comps || !names || !attrs) {
+		res = TOP_E_ALLOC;
+	} else {
+		res = graph_append_map(g, src, comps, names, attrs);
+	}
+	for (graph_id_t i = 0; !res && (i < src->n_nodes); i++) {
+		res = graph_add_node_id(g, names[src->name_ids[i]],
+			src->types[i], attrs[src->nodes[i].attr]);
+		if (!res)
+			g->nodes[base + i].n_auto = src->nodes[i].n_auto;
+	}
+	for (graph_id_t i = 0; !res && (i < src->n_nodes); i++) {
+		node_t *node = &src->nodes[i];
+		for (graph_id_t j = 0; !res && (j < node->n_adj); j++) {
+			res = graph_adj_push(g, &g->nodes[base + i],
+				base + node->adj[j].n, attrs[node->adj[j].attr]);
+		}
+	}
+	if (!res)
+		g->n_dead += src->n_dead;
+	free(comps);
+	free(names);
+	free(attrs);
+	return res;
+}
+
+static graph_id_t
+graph_neighbor (graph_t *g, graph_id_t i, graph_id_t j)
+{
+	if (g->csr)
+		return g->csr->adj[g->csr->offsets[i] + j];
+	return g->nodes[i].adj[j].n;
+}
+
+static int
+graph_edge_attr (graph_t *g, graph_id_t i, graph_id_t j)
+{
+	if (g->csr)
+		return g->csr->adj_attrs[g->csr->offsets[i] + j];
+	return g->nodes[i].adj[j].attr;
+}
+
+static void
+csr_destroy (graph_csr_t *csr)
+{
+	free(csr->offsets);
+	free(csr->adj);
+	free(csr->adj_attrs);
+	free(csr);
+}
+
+/* Moves the adjacency lists into one contiguous CSR layout.  A frozen
+ * graph is read-only: it can be printed, looked up and destroyed, but
+ * adding to it or compacting it fails with TOP_E_FROZEN. */
+int
+topologies_graph_freeze (graph_t *g, char *e_text, size_t e_size)
+{
+	if (g->csr)
+		return 0;
+	graph_id_t n_edges = 0;
+	for (graph_id_t i = 0; i < g->n_nodes; i++)
+		n_edges += g->nodes[i].n_adj;
+
+	graph_csr_t *csr = (graph_csr_t *) calloc(1, sizeof(graph_csr_t));
+	if (!csr)
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	csr->offsets = (graph_id_t *) malloc((g->n_nodes + 1) *
+		sizeof(graph_id_t));
+	csr->adj = (graph_id_t *) malloc((n_edges + 1) * sizeof(graph_id_t));
+	csr->adj_attrs = (int *) malloc((n_edges + 1) * sizeof(int));
+	/* an arena holds nothing but the node array and the adjacency blocks,
+	 * so the array moves out and the arena goes with the blocks */
+	node_t *nodes = NULL;
+	if (g->arena)
+		nodes = (node_t *) malloc(g->cap_nodes * sizeof(node_t));
+	if (!csr->offsets || !csr->adj || !csr->adj_attrs ||
+		(g->arena && !nodes))
+	{
+		free(nodes);
+		csr_destroy(csr);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+
+	graph_id_t k = 0;
+	for (graph_id_t i = 0; i < g->n_nodes; i++) {
+		csr->offsets[i] = k;
+		for (graph_id_t j = 0; j < g->nodes[i].n_adj; j++, k++) {
+			csr->adj[k] = g->nodes[i].adj[j].n;
+			csr->adj_attrs[k] = g->nodes[i].adj[j].attr;
+		}
+		if (!g->arena) {
+			free(g->nodes[i].adj);
+			free(g->nodes[i].adj_set);
+		}
+		g->nodes[i].adj = NULL;
+		g->nodes[i].cap_adj = 0;
+		g->nodes[i].adj_set = NULL;
+		g->nodes[i].cap_adj_set = 0;
+	}
+	csr->offsets[g->n_nodes] = k;
+	if (g->arena) {
+		memcpy(nodes, g->nodes, g->cap_nodes * sizeof(node_t));
+		arena_destroy(g->arena);
+		g->arena = NULL;
+		g->nodes = nodes;
+	}
+	g->csr = csr;
+	return 0;
+}
+
+static graph_id_t
+graph_print_next (graph_t *g, graph_id_t n, bool print_gate_nodes)
+{
+	return print_gate_nodes ? n : graph_next_node(g, n);
 }
 
 void
 topologies_graph_print (graph_t *g, FILE *stream, bool print_gate_nodes)
 {
+	char *name = NULL;
+	size_t name_cap = 0;
 	fprintf(stream, "graph g {\n");
-	for (int i = 0; i < g->n_nodes; i++) {
-		if ((g->nodes[i].type == NODE_NODE) || print_gate_nodes) {
-			fprintf(stream, "n%d [label=\"%s\"",
-				i, g->nodes[i].name);
-			if (g->nodes[i].attributes)
-				fprintf(stream, ", %s", g->nodes[i].attributes);
-			fprintf(stream, "];\n");
-		}
+	for (graph_id_t i = graph_print_next(g, 0, print_gate_nodes);
+		i < g->n_nodes; i = graph_print_next(g, i + 1, print_gate_nodes))
+	{
+		char *attrs = graph_attr(g, g->nodes[i].attr);
+		if (!graph_node_name(g, i, &name, &name_cap))
+			break;
+		fprintf(stream, "n%" PRI_GRAPH_ID " [label=\"%s\"", i, name);
+		if (attrs)
+			fprintf(stream, ", %s", attrs);
+		fprintf(stream, "];\n");
 	}
-	for (int i = 0; i < g->n_nodes; i++) {
-		if ((g->nodes[i].type != NODE_NODE) && !print_gate_nodes)
-			continue;
-		for (int j = 0; j < g->nodes[i].n_adj; j++) {
-			if (i > g->nodes[i].adj[j].n) continue;
-			if (!print_gate_nodes &&
-				g->nodes[g->nodes[i].adj[j].n].type != NODE_NODE)
-			{
+	for (graph_id_t i = graph_print_next(g, 0, print_gate_nodes);
+		i < g->n_nodes; i = graph_print_next(g, i + 1, print_gate_nodes))
+	{
+		for (graph_id_t j = 0; j < g->nodes[i].n_adj; j++) {
+			graph_id_t n = graph_neighbor(g, i, j);
+			if (i > n) continue;
+			if (!print_gate_nodes && g->types[n] != NODE_NODE)
 				continue;
-			}
-			fprintf(stream, "n%d -- n%d", i, g->nodes[i].adj[j].n);
-			if (g->nodes[i].adj[j].attributes)
-				fprintf(stream, " [%s]", g->nodes[i].adj[j].attributes);
+			char *attrs = graph_attr(g, graph_edge_attr(g, i, j));
+			fprintf(stream, "n%" PRI_GRAPH_ID " -- n%" PRI_GRAPH_ID, i, n);
+			if (attrs)
+				fprintf(stream, " [%s]", attrs);
 			fprintf(stream, ";\n");
 		}
 	}
 	fprintf(stream, "}\n");
+	free(name);
 }
 
 char *
 topologies_graph_string (graph_t *g, bool print_gate_nodes)
 {
-	int buf_len = 0;
+	size_t buf_len = 0;
 
 	buf_len += snprintf(0, 0, "graph g {\n");
-	for (int i = 0; i < g->n_nodes; i++) {
-		if ((g->nodes[i].type == NODE_NODE) || print_gate_nodes) {
-			buf_len += snprintf(0, 0, "n%d [label=\"%s\"",
-				i, g->nodes[i].name);
-			if (g->nodes[i].attributes)
-				buf_len += snprintf(0, 0, ", %s", g->nodes[i].attributes);
-			buf_len += snprintf(0, 0, "];\n");
-		}
+	for (graph_id_t i = graph_print_next(g, 0, print_gate_nodes);
+		i < g->n_nodes; i = graph_print_next(g, i + 1, print_gate_nodes))
+	{
+		char *attrs = graph_attr(g, g->nodes[i].attr);
+		buf_len += snprintf(0, 0, "n%" PRI_GRAPH_ID " [label=\"\"", i) +
+			name_trie_len(g->names, g->name_ids[i]);
+		if (attrs)
+			buf_len += snprintf(0, 0, ", %s", attrs);
+		buf_len += snprintf(0, 0, "];\n");
 	}
-	for (int i = 0; i < g->n_nodes; i++) {
-		if ((g->nodes[i].type != NODE_NODE) && !print_gate_nodes)
-			continue;
-		for (int j = 0; j < g->nodes[i].n_adj; j++) {
-			if (i > g->nodes[i].adj[j].n) continue;
-			if (!print_gate_nodes &&
-				g->nodes[g->nodes[i].adj[j].n].type != NODE_NODE)
-			{
+	for (graph_id_t i = graph_print_next(g, 0, print_gate_nodes);
+		i < g->n_nodes; i = graph_print_next(g, i + 1, print_gate_nodes))
+	{
+		for (graph_id_t j = 0; j < g->nodes[i].n_adj; j++) {
+			graph_id_t n = graph_neighbor(g, i, j);
+			if (i > n) continue;
+			if (!print_gate_nodes && g->types[n] != NODE_NODE)
 				continue;
-			}
-			buf_len += snprintf(0, 0, "n%d -- n%d", i, g->nodes[i].adj[j].n);
-			if (g->nodes[i].adj[j].attributes)
-				buf_len += snprintf(0, 0, " [%s]", g->nodes[i].adj[j].attributes);
+			char *attrs = graph_attr(g, graph_edge_attr(g, i, j));
+			buf_len += snprintf(0, 0, "n%" PRI_GRAPH_ID " -- n%" PRI_GRAPH_ID, i, n);
+			if (attrs)
+				buf_len += snprintf(0, 0, " [%s]", attrs);
 			buf_len += snprintf(0, 0, ";\n");
 		}
 	}
@@ -221,32 +850,30 @@ topologies_graph_string (graph_t *g, bool print_gate_nodes)
 
 	buf_len = 0;
 	buf_len += sprintf(buf, "graph g {\n");
-	for (int i = 0; i < g->n_nodes; i++) {
-		if ((g->nodes[i].type == NODE_NODE) || print_gate_nodes) {
-			buf_len += sprintf(buf + buf_len, "n%d [label=\"%s\"",
-				i, g->nodes[i].name);
-			if (g->nodes[i].attributes) {
-				buf_len += sprintf(buf + buf_len, ", %s",
-					g->nodes[i].attributes);
-			}
-			buf_len += sprintf(buf + buf_len, "];\n");
-		}
+	for (graph_id_t i = graph_print_next(g, 0, print_gate_nodes);
+		i < g->n_nodes; i = graph_print_next(g, i + 1, print_gate_nodes))
+	{
+		char *attrs = graph_attr(g, g->nodes[i].attr);
+		buf_len += sprintf(buf + buf_len, "n%" PRI_GRAPH_ID " [label=\"", i);
+		name_trie_str(g->names, g->name_ids[i], buf + buf_len);
+		buf_len += name_trie_len(g->names, g->name_ids[i]);
+		buf_len += sprintf(buf + buf_len, "\"");
+		if (attrs)
+			buf_len += sprintf(buf + buf_len, ", %s", attrs);
+		buf_len += sprintf(buf + buf_len, "];\n");
 	}
-	for (int i = 0; i < g->n_nodes; i++) {
-		if ((g->nodes[i].type != NODE_NODE) && !print_gate_nodes)
-			continue;
-		for (int j = 0; j < g->nodes[i].n_adj; j++) {
-			if (i > g->nodes[i].adj[j].n) continue;
-			if (!print_gate_nodes &&
-				g->nodes[g->nodes[i].adj[j].n].type != NODE_NODE)
-			{
+	for (graph_id_t i = graph_print_next(g, 0, print_gate_nodes);
+		i < g->n_nodes; i = graph_print_next(g, i + 1, print_gate_nodes))
+	{
+		for (graph_id_t j = 0; j < g->nodes[i].n_adj; j++) {
+			graph_id_t n = graph_neighbor(g, i, j);
+			if (i > n) continue;
+			if (!print_gate_nodes && g->types[n] != NODE_NODE)
 				continue;
-			}
-			buf_len += sprintf(buf + buf_len, "n%d -- n%d", i, g->nodes[i].adj[j].n);
-			if (g->nodes[i].adj[j].attributes) {
-				buf_len += sprintf(buf + buf_len, " [%s]",
-					g->nodes[i].adj[j].attributes);
-			}
+			char *attrs = graph_attr(g, graph_edge_attr(g, i, j));
+			buf_len += sprintf(buf + buf_len, "n%" PRI_GRAPH_ID " -- n%" PRI_GRAPH_ID, i, n);
+			if (attrs)
+				buf_len += sprintf(buf + buf_len, " [%s]", attrs);
 			buf_len += sprintf(buf + buf_len, ";\n");
 		}
 	}
@@ -263,19 +890,22 @@ topologies_graph_string_free (char *string)
 void
 topologies_graph_destroy (graph_t *g)
 {
-	if (g->nodes) {
-		for (int i = 0; i < g->n_nodes; i++) {
-			free(g->nodes[i].name);
-			for (int j = 0; j < g->nodes[i].n_adj; j++) {
-				if (g->nodes[i].adj[j].attributes)
-					free(g->nodes[i].adj[j].attributes);
-			}
+	if (g->arena) {
+		arena_destroy(g->arena);
+	} else if (g->nodes) {
+		for (graph_id_t i = 0; i < g->n_nodes; i++) {
 			free(g->nodes[i].adj);
-			if (g->nodes[i].attributes)
-				free(g->nodes[i].attributes);
+			free(g->nodes[i].adj_set);
 		}
 		free(g->nodes);
 	}
+	if (g->csr)
+		csr_destroy(g->csr);
+	free(g->name_ids);
+	free(g->types);
+	free(g->node_bits);
+	name_trie_destroy(g->names);
+	str_pool_destroy(g->attrs);
+	free(g->index);
 	free(g);
 }
-
@@ -4,21 +4,74 @@
 #include "defs.h"
 
 int
-graph_add_node (graph_t *g, char *name, node_type type, char *attrs);
+graph_attr_id (graph_t *g, char *attrs, int *r_attr);
+
+char *
+graph_attr (graph_t *g, int attr);
+
+int
+graph_add_node_id (graph_t *g, graph_id_t name, node_type type, int attr);
 
 int
+graph_add_node (graph_t *g, char *name, node_type type, int attr);
+
+void
+graph_set_type (graph_t *g, graph_id_t n, node_type type);
+
+graph_id_t
+graph_next_node (graph_t *g, graph_id_t n);
+
+graph_id_t
+graph_count_nodes (graph_t *g);
+
+char *
+graph_node_name (graph_t *g, graph_id_t n, char **buf, size_t *cap);
+
+graph_id_t
+graph_find_node_id (graph_t *g, graph_id_t name);
+
+bool
+graph_name_used (graph_t *g, graph_id_t name);
+
+int
+graph_vacuum (graph_t *g);
+
+int
+graph_select_prefixed (graph_t *g, const char *prefix, graph_id_t **r_ids,
+	graph_id_t *r_n);
+
+graph_id_t
 graph_find_node (graph_t *g, char *name);
 
 int
-graph_add_edge_id (graph_t *g, int node_a, int node_b, char *attrs);
+graph_add_edge_id (graph_t *g, graph_id_t node_a, graph_id_t node_b,
+	int attr);
+
+bool
+graph_are_adjacent (graph_t *g, node_t *node_a, node_t *node_b);
+
+int
+graph_add_edge_name (graph_t *g, char *name_a, char *name_b, int attr);
+
+int
+graph_append (graph_t *g, graph_t *src);
 
 bool
-graph_are_adjacent (node_t *node_a, node_t *node_b);
+graph_adj_has (graph_t *g, node_t *node, graph_id_t n);
+
+int
+graph_adj_push (graph_t *g, node_t *node, graph_id_t n, int attr);
+
+void
+graph_adj_set_n (node_t *node, graph_id_t j, graph_id_t n);
+
+void
+graph_adj_clear (node_t *node);
 
 int
-graph_add_edge_name (graph_t *g, char *name_a, char *name_b, char *attrs);
+graph_reserve (graph_t *g, graph_id_t n_nodes, graph_id_t n_edges);
 
 graph_t *
-graph_create (void);
+graph_create (int flags);
 
 #endif
@@ -65,6 +65,12 @@ main (int argc, char *argv[])
 		fprintf(stderr, "%s\n", e_text);
 		exit(EXIT_FAILURE);
 	}
+	if (topologies_graph_freeze(graph, e_text, e_size)) {
+		topologies_graph_destroy(graph);
+		topologies_network_destroy(net);
+		fprintf(stderr, "%s\n", e_text);
+		exit(EXIT_FAILURE);
+	}
 	topologies_graph_print(graph, stdout, false);
 	topologies_graph_destroy(graph);
 
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <regex.h>
+
+#include "defs.h"
+#include "name_match.h"
+#include "errors.h"
+
+/* Most patterns of all-match connections and replacements are plain names
+ * such as "node" or "s$".  Those are told apart when the pattern is read
+ * and matched with strstr or a comparison of the tail, which is much
+ * cheaper than running regexec on every name. */
+
+/* returns the length of the unescaped pattern if it is a literal, else -1;
+ * escaped special characters are literal, any other escape is taken for
+ * an operator of the GNU extensions */
+static long
+name_match_literal (const char *pattern, char *literal, bool *r_at_end)
+{
+	size_t len = 0;
+	*r_at_end = false;
+	for (const char *c = pattern; *c; c++) {
+		if (*c == '\\') {
+			c++;
+			if (!*c || !strchr(".[*^$\\", *c))
+				return -1;
+		} else if ((*c == '$') && !c[1]) {
+			*r_at_end = true;
+			break;
+		} else if (strchr(".[*^$", *c)) {
+			return -1;
+		}
+		if (literal)
+			literal[len] = *c;
+		len++;
+	}
+	return len;
+}
+
+/* returns TOP_E_REGEX if pattern is not a valid expression */
+int
+name_match_init (name_match_t *m, const char *pattern)
+{
+	long len = name_match_literal(pattern, NULL, &m->at_end);
+	if (len < 0) {
+		m->literal = NULL;
+		if (regcomp(&m->regex, pattern, 0))
+			return TOP_E_REGEX;
+		return 0;
+	}
+	m->literal = (char *) malloc(len + 1);
+	if (!m->literal)
+		return TOP_E_ALLOC;
+	name_match_literal(pattern, m->literal, &m->at_end);
+	m->literal[len] = '\0';
+	m->len = len;
+	return 0;
+}
+
+bool
+name_match (name_match_t *m, const char *name)
+{
+	if (!m->literal)
+		return !regexec(&m->regex, name, 0, NULL, REG_EXTENDED);
+	if (!m->at_end)
+		return strstr(name, m->literal) != NULL;
+	size_t len = strlen(name);
+	return (len >= m->len) &&
+		(memcmp(name + len - m->len, m->literal, m->len) == 0);
+}
+
+void
+name_match_free (name_match_t *m)
+{
+	if (m->literal)
+		free(m->literal);
+	else
+		regfree(&m->regex);
+}
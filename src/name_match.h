@@ -0,0 +1,15 @@
+#ifndef NAME_MATCH_H
+# define NAME_MATCH_H
+
+#include "defs.h"
+
+int
+name_match_init (name_match_t *m, const char *pattern);
+
+bool
+name_match (name_match_t *m, const char *name);
+
+void
+name_match_free (name_match_t *m);
+
+#endif
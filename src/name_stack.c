@@ -7,116 +7,127 @@
 #include "name_stack.h"
 #include "errors.h"
 
+static int
+name_stack_grow (char **buf, size_t *cap, size_t len)
+{
+	if (len + 1 <= *cap)
+		return 0;
+	size_t new_cap = *cap ? *cap : NAME_STACK_BLK_SIZE;
+	while (new_cap < len + 1)
+		new_cap *= 2;
+	char *new_buf = (char *) realloc(*buf, new_cap);
+	if (!new_buf)
+		return TOP_E_ALLOC;
+	*buf = new_buf;
+	*cap = new_cap;
+	return 0;
+}
+
 name_stack_t *
 name_stack_create (char *name)
 {
-	name_stack_t *s = (name_stack_t *) malloc(sizeof(name_stack_t));
+	name_stack_t *s = (name_stack_t *) calloc(1, sizeof(name_stack_t));
 	if (!s) return NULL;
-	s->next = NULL;
-	s->name = (char *) malloc(strlen(name) + 1);
-	if (!s->name) {
-		free(s);
+	s->cap_depth = NAME_STACK_DEPTH;
+	s->starts = (size_t *) malloc(s->cap_depth * sizeof(size_t));
+	if (!s->starts || name_stack_grow(&s->buf, &s->cap, strlen(name))) {
+		name_stack_destroy(s);
 		return NULL;
 	}
-	strncpy(s->name, name, strlen(name) + 1);
+	s->starts[0] = 0;
+	s->depth = 1;
+	s->len = strlen(name);
+	memcpy(s->buf, name, s->len + 1);
 	return s;
 }
 
 int
 name_stack_enter (name_stack_t *s, char *name, int index)
 {
-	int len;
-	name_stack_t *head = s;
-	while (head->next != NULL)
-		head = head->next;
-	head->next = (name_stack_t *) malloc(sizeof(name_stack_t));
-	if (!head->next)
-		return TOP_E_ALLOC;
-	head = head->next;
-	head->next = NULL;
-	if (index < 0) {
-		len = strlen(name) + 1;
-		head->name = (char *) malloc(len);
-		if (!head->name) {
-			free(head);
+	size_t name_len = strlen(name);
+	if (index >= 0)
+		name_len += snprintf(0, 0, "[%d]", index);
+	bool sep = s->len > s->starts[s->depth - 1];
+	if (s->depth == s->cap_depth) {
+		size_t *starts = (size_t *) realloc(s->starts,
+			2 * s->cap_depth * sizeof(size_t));
+		if (!starts)
 			return TOP_E_ALLOC;
-		}
-		strncpy(head->name, name, len);
-	} else {
-		len = snprintf(0, 0, "%s[%d]", name, index) + 1;
-		head->name = (char *) malloc(len);
-		if (!head->name) {
-			free(head);
-			return TOP_E_ALLOC;
-		}
-		snprintf(head->name, len, "%s[%d]", name, index);
+		s->starts = starts;
+		s->cap_depth *= 2;
 	}
+	if (name_stack_grow(&s->buf, &s->cap, s->len + sep + name_len))
+		return TOP_E_ALLOC;
+	if (sep)
+		s->buf[s->len++] = '.';
+	s->starts[s->depth++] = s->len;
+	if (index < 0)
+		memcpy(s->buf + s->len, name, name_len + 1);
+	else
+		sprintf(s->buf + s->len, "%s[%d]", name, index);
+	s->len += name_len;
+	s->gen++;
 	return 0;
 }
 
 void
 name_stack_leave (name_stack_t *s)
 {
-	name_stack_t *head = s;
-	if (head->next == NULL)
+	if (s->depth == 1)
 		return;
-	while (head->next->next != NULL)
-		head = head->next;
-	free(head->next->name);
-	free(head->next);
-	head->next = NULL;
+	s->depth--;
+	s->len = s->starts[s->depth];
+	/* the separator is there iff the entry below is not empty */
+	if (s->len > s->starts[s->depth - 1])
+		s->len--;
+	s->buf[s->len] = '\0';
+	s->gen++;
 }
 
+/* returns the dotted name of the stack; the string belongs to the stack
+ * and is valid until the next enter or leave */
 char *
 name_stack_name (name_stack_t *s)
 {
-	unsigned len = 0, off = 0;
-	name_stack_t *head = s;
-	if (!head) return NULL;
-	while (head->next != NULL) {
-		len += strlen(head->name) + 1;
-		head = head->next;
-	}
-	len += strlen(head->name) + 1;
-	char *name = (char *) malloc(len);
-	if (!name) return NULL;
-	head = s;
-	while (head->next != NULL) {
-		if (strlen(head->name) != 0) {
-			snprintf(name + off, strlen(head->name) + 2, "%s.", head->name);
-			off += strlen(head->name) + 1;
-		}
-		head = head->next;
-	}
-	snprintf(name + off, strlen(head->name) + 2, "%s", head->name);
-	return name;
+	return s->buf;
 }
 
+/* writes the name of the stack, a dot and name[index] (or name, if index
+ * is -1) to *buf of *cap chars, growing it if needed; returns *buf or
+ * NULL if out of memory */
 char *
-get_full_name (name_stack_t *s, char *name, int index)
+get_full_name (name_stack_t *s, char *name, int index, char **buf,
+	size_t *cap)
 {
-	int added_len = 0;
-	if (index != -1) {
-		added_len = snprintf(0, 0, "[%d]", index);
-	}
-	char *name_s = name_stack_name(s);
-	if (!name_s)
+	size_t name_len = strlen(name);
+	size_t len = s->len + 1 + name_len;
+	if (index != -1)
+		len += snprintf(0, 0, "[%d]", index);
+	if (name_stack_grow(buf, cap, len))
 		return NULL;
-	char *full_name =
-		(char *) malloc(strlen(name) + strlen(name_s) + added_len + 2);
-	if (!full_name) {
-		free(name_s);
-		return NULL;
-	}
-	strncpy(full_name, name_s, strlen(name_s));
-	full_name[strlen(name_s)] = '.';
-	strncpy(full_name + strlen(name_s) + 1, name,
-		strlen(name) + 1);
-	if (index != -1) {
-		snprintf(full_name + strlen(name_s) + strlen(name) + 1,
-			added_len + 1, "[%d]", index);
-	}
-	free(name_s);
-	return full_name;
+	memcpy(*buf, s->buf, s->len);
+	(*buf)[s->len] = '.';
+	if (index != -1)
+		sprintf(*buf + s->len + 1, "%s[%d]", name, index);
+	else
+		memcpy(*buf + s->len + 1, name, name_len + 1);
+	return *buf;
+}
+
+void
+name_buf_free (name_buf_t *b)
+{
+	free(b->buf);
+	free(b->ends);
+	free(b->vers);
 }
 
+void
+name_stack_destroy (name_stack_t *s)
+{
+	free(s->buf);
+	free(s->starts);
+	name_buf_free(&s->conn_a);
+	name_buf_free(&s->conn_b);
+	free(s);
+}
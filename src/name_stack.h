@@ -14,6 +14,13 @@ char *
 name_stack_name (name_stack_t *s);
 
 char *
-get_full_name (name_stack_t *s, char *name, int index);
+get_full_name (name_stack_t *s, char *name, int index, char **buf,
+	size_t *cap);
+
+void
+name_buf_free (name_buf_t *b);
+
+void
+name_stack_destroy (name_stack_t *s);
 
 #endif
@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "defs.h"
+#include "name_trie.h"
+#include "str_pool.h"
+
+/* Node names share long prefixes, n.p[12].p[3].n[5].port[2] and its
+ * neighbours differ in the last component or two.  The trie stores every
+ * distinct prefix once, as a (parent, component) pair with the component
+ * interned in a string pool, so a name costs a few ints instead of a
+ * string of its own.  Full names are only rebuilt for output and regular
+ * expressions.
+ *
+ * Names are split at dots outside of brackets and parentheses, so that
+ * indices and product names like (n.a,n.b) stay single components.
+ * Joining the components back gives the original string, hence equal
+ * names map to equal ids. */
+
+static size_t
+name_trie_hash (graph_id_t parent, graph_id_t comp)
+{
+	return ((size_t) parent * 2654435761u) ^ ((size_t) comp * 40503u);
+}
+
+static void
+name_trie_index_insert (graph_id_t *index, graph_id_t cap_index,
+	name_entry_t *e, graph_id_t id)
+{
+	size_t k = name_trie_hash(e->parent, e->comp) & (cap_index - 1);
+	while (index[k] >= 0)
+		k = (k + 1) & (cap_index - 1);
+	index[k] = id;
+}
+
+static int
+name_trie_index_grow (name_trie_t *t, graph_id_t cap_index)
+{
+	graph_id_t *index = (graph_id_t *) malloc(cap_index *
+		sizeof(graph_id_t));
+	if (!index) return -1;
+	memset(index, -1, cap_index * sizeof(graph_id_t));
+	for (graph_id_t i = NAME_TRIE_ROOT + 1; i < t->n_entries; i++)
+		name_trie_index_insert(index, cap_index, &t->entries[i], i);
+	free(t->index);
+	t->index = index;
+	t->cap_index = cap_index;
+	return 0;
+}
+
+name_trie_t *
+name_trie_create (void)
+{
+	name_trie_t *t = (name_trie_t *) calloc(1, sizeof(name_trie_t));
+	if (!t) return NULL;
+	t->comps = str_pool_create();
+	t->cap_entries = NAME_TRIE_BLK_SIZE;
+	t->entries = (name_entry_t *) malloc(t->cap_entries *
+		sizeof(name_entry_t));
+	t->cap_index = 2 * NAME_TRIE_BLK_SIZE;
+	t->index = (graph_id_t *) malloc(t->cap_index * sizeof(graph_id_t));
+	if (!t->comps || !t->entries || !t->index) {
+		name_trie_destroy(t);
+		return NULL;
+	}
+	memset(t->index, -1, t->cap_index * sizeof(graph_id_t));
+	t->entries[NAME_TRIE_ROOT].parent = -1;
+	t->entries[NAME_TRIE_ROOT].comp = -1;
+	t->entries[NAME_TRIE_ROOT].len = 0;
+	t->entries[NAME_TRIE_ROOT].first_child = -1;
+	t->entries[NAME_TRIE_ROOT].next_sibling = -1;
+	t->n_entries = 1;
+	return t;
+}
+
+/* returns the id of the child of parent named comp; if there is none, it
+ * is added when add is set, otherwise -1 is returned.  -1 is also returned
+ * if out of memory */
+graph_id_t
+name_trie_child (name_trie_t *t, graph_id_t parent, const char *comp,
+	bool add)
+{
+	graph_id_t c = add ? str_pool_add(t->comps, comp) :
+		str_pool_find(t->comps, comp);
+	if (c < 0)
+		return -1;
+	return name_trie_child_id(t, parent, c, add);
+}
+
+/* same as name_trie_child with the component given by its id in comps */
+graph_id_t
+name_trie_child_id (name_trie_t *t, graph_id_t parent, graph_id_t c,
+	bool add)
+{
+	size_t k = name_trie_hash(parent, c) & (t->cap_index - 1);
+	for (; t->index[k] >= 0; k = (k + 1) & (t->cap_index - 1)) {
+		name_entry_t *e = &t->entries[t->index[k]];
+		if ((e->parent == parent) && (e->comp == c))
+			return t->index[k];
+	}
+	if (!add)
+		return -1;
+
+	if (2 * t->n_entries > t->cap_index) {
+		if (name_trie_index_grow(t, 2 * t->cap_index))
+			return -1;
+	}
+	if (t->n_entries == t->cap_entries) {
+		name_entry_t *entries = (name_entry_t *) realloc(t->entries,
+			2 * t->cap_entries * sizeof(name_entry_t));
+		if (!entries) return -1;
+		t->entries = entries;
+		t->cap_entries *= 2;
+	}
+	graph_id_t id = t->n_entries;
+	name_entry_t *e = &t->entries[id];
+	e->parent = parent;
+	e->comp = c;
+	e->len = strlen(t->comps->strs[c]);
+	if (parent != NAME_TRIE_ROOT)
+		e->len += t->entries[parent].len + 1;
+	e->first_child = -1;
+	e->next_sibling = t->entries[parent].first_child;
+	t->entries[parent].first_child = id;
+	name_trie_index_insert(t->index, t->cap_index, e, id);
+	t->n_entries++;
+	return id;
+}
+
+static graph_id_t
+name_trie_walk (name_trie_t *t, const char *name, bool add)
+{
+	char tmp[256];
+	char *buf = tmp;
+	size_t len = strlen(name);
+	if (len >= sizeof(tmp)) {
+		buf = (char *) malloc(len + 1);
+		if (!buf) return -1;
+	}
+	memcpy(buf, name, len + 1);
+
+	graph_id_t id = NAME_TRIE_ROOT;
+	int depth = 0;
+	char *comp = buf;
+	for (char *c = buf; ; c++) {
+		if (*c == '\0') {
+			id = name_trie_child(t, id, comp, add);
+			break;
+		} else if ((*c == '(') || (*c == '[')) {
+			depth++;
+		} else if ((*c == ')') || (*c == ']')) {
+			depth--;
+		} else if ((*c == '.') && (depth == 0)) {
+			*c = '\0';
+			if ((id = name_trie_child(t, id, comp, add)) < 0)
+				break;
+			comp = c + 1;
+		}
+	}
+	if (buf != tmp)
+		free(buf);
+	return id;
+}
+
+/* interns the full name and returns its id, or -1 if out of memory */
+graph_id_t
+name_trie_add (name_trie_t *t, const char *name)
+{
+	return name_trie_walk(t, name, true);
+}
+
+/* returns the id of the full name, or -1 if it was never added */
+graph_id_t
+name_trie_find (name_trie_t *t, const char *name)
+{
+	return name_trie_walk(t, name, false);
+}
+
+static int
+name_trie_push (graph_id_t **ids, graph_id_t *n, graph_id_t *cap,
+	graph_id_t id)
+{
+	if (*n == *cap) {
+		graph_id_t *new_ids = (graph_id_t *) realloc(*ids,
+			2 * *cap * sizeof(graph_id_t));
+		if (!new_ids) return -1;
+		*ids = new_ids;
+		*cap *= 2;
+	}
+	(*ids)[(*n)++] = id;
+	return 0;
+}
+
+/* Sets *r_ids to the ids of the entries whose full names start with the
+ * string prefix, which need not end at a component: n.p[1] takes in
+ * n.p[1].a and n.p[12].a alike.  Only the subtrees under the components
+ * of the prefix are visited.  The caller frees *r_ids.  Returns -1 if
+ * out of memory. */
+int
+name_trie_prefixed (name_trie_t *t, const char *prefix, graph_id_t **r_ids,
+	graph_id_t *r_n)
+{
+	/* the components before the last one must match whole */
+	const char *last = prefix;
+	int depth = 0;
+	for (const char *c = prefix; *c; c++) {
+		if ((*c == '(') || (*c == '['))
+			depth++;
+		else if ((*c == ')') || (*c == ']'))
+			depth--;
+		else if ((*c == '.') && (depth == 0))
+			last = c + 1;
+	}
+	graph_id_t parent = NAME_TRIE_ROOT;
+	if (last != prefix) {
+		size_t len = last - 1 - prefix;
+		char *head = (char *) malloc(len + 1);
+		if (!head) return -1;
+		memcpy(head, prefix, len);
+		head[len] = '\0';
+		parent = name_trie_find(t, head);
+		free(head);
+	}
+
+	graph_id_t n = 0, cap = NAME_TRIE_BLK_SIZE;
+	graph_id_t *ids = (graph_id_t *) malloc(cap * sizeof(graph_id_t));
+	if (!ids) return -1;
+	size_t last_len = strlen(last);
+	graph_id_t c = (parent < 0) ? -1 : t->entries[parent].first_child;
+	for (; c >= 0; c = t->entries[c].next_sibling) {
+		if ((strncmp(t->comps->strs[t->entries[c].comp], last,
+			last_len) == 0) && name_trie_push(&ids, &n, &cap, c))
+		{
+			free(ids);
+			return -1;
+		}
+	}
+	/* the entries found so far double as the queue of the subtrees */
+	for (graph_id_t i = 0; i < n; i++) {
+		c = t->entries[ids[i]].first_child;
+		for (; c >= 0; c = t->entries[c].next_sibling) {
+			if (name_trie_push(&ids, &n, &cap, c)) {
+				free(ids);
+				return -1;
+			}
+		}
+	}
+	*r_ids = ids;
+	*r_n = n;
+	return 0;
+}
+
+/* makes room for n entries in total */
+int
+name_trie_reserve (name_trie_t *t, graph_id_t n)
+{
+	graph_id_t cap_index = t->cap_index;
+	while (2 * n > cap_index)
+		cap_index *= 2;
+	if ((cap_index > t->cap_index) && name_trie_index_grow(t, cap_index))
+		return -1;
+	if (n > t->cap_entries) {
+		name_entry_t *entries = (name_entry_t *) realloc(t->entries,
+			n * sizeof(name_entry_t));
+		if (!entries) return -1;
+		t->entries = entries;
+		t->cap_entries = n;
+	}
+	return 0;
+}
+
+int
+name_trie_len (name_trie_t *t, graph_id_t id)
+{
+	return t->entries[id].len;
+}
+
+/* writes the full name of id to buf, which must have room for
+ * name_trie_len(t, id) + 1 chars */
+char *
+name_trie_str (name_trie_t *t, graph_id_t id, char *buf)
+{
+	int pos = t->entries[id].len;
+	buf[pos] = '\0';
+	while (id != NAME_TRIE_ROOT) {
+		name_entry_t *e = &t->entries[id];
+		int len = e->len;
+		if (e->parent != NAME_TRIE_ROOT)
+			len -= t->entries[e->parent].len + 1;
+		pos -= len;
+		memcpy(buf + pos, t->comps->strs[e->comp], len);
+		if (e->parent != NAME_TRIE_ROOT)
+			buf[--pos] = '.';
+		id = e->parent;
+	}
+	return buf;
+}
+
+/* same as name_trie_str, growing *buf of *cap chars to fit */
+char *
+name_trie_name (name_trie_t *t, graph_id_t id, char **buf, size_t *cap)
+{
+	size_t len = t->entries[id].len + 1;
+	if (*cap < len) {
+		char *b = (char *) realloc(*buf, len);
+		if (!b) return NULL;
+		*buf = b;
+		*cap = len;
+	}
+	return name_trie_str(t, id, *buf);
+}
+
+void
+name_trie_destroy (name_trie_t *t)
+{
+	if (!t) return;
+	str_pool_destroy(t->comps);
+	free(t->entries);
+	free(t->index);
+	free(t);
+}
@@ -0,0 +1,42 @@
+#ifndef NAME_TRIE_H
+# define NAME_TRIE_H
+
+#include "defs.h"
+
+name_trie_t *
+name_trie_create (void);
+
+graph_id_t
+name_trie_child (name_trie_t *t, graph_id_t parent, const char *comp,
+	bool add);
+
+graph_id_t
+name_trie_child_id (name_trie_t *t, graph_id_t parent, graph_id_t c,
+	bool add);
+
+graph_id_t
+name_trie_add (name_trie_t *t, const char *name);
+
+graph_id_t
+name_trie_find (name_trie_t *t, const char *name);
+
+int
+name_trie_prefixed (name_trie_t *t, const char *prefix, graph_id_t **r_ids,
+	graph_id_t *r_n);
+
+int
+name_trie_reserve (name_trie_t *t, graph_id_t n);
+
+int
+name_trie_len (name_trie_t *t, graph_id_t id);
+
+char *
+name_trie_str (name_trie_t *t, graph_id_t id, char *buf);
+
+char *
+name_trie_name (name_trie_t *t, graph_id_t id, char **buf, size_t *cap);
+
+void
+name_trie_destroy (name_trie_t *t);
+
+#endif
@@ -4,93 +4,241 @@
 #include <string.h>
 #include <math.h>
 
-#include "tinyexpr.h"
-
 #include "parser.h"
 #include "param_stack.h"
+#include "expr_cache.h"
+#include "str_pool.h"
 #include "defs.h"
 #include "errors.h"
 
 param_stack_t *
-param_stack_create (void)
+param_stack_create (expr_cache_t *exprs)
 {
 	param_stack_t *p = (param_stack_t *) malloc(sizeof(param_stack_t));
 	if (!p) return NULL;
+	p->exprs = exprs;
 	p->n = 0;
 	p->cap = PARAM_BLK_SIZE;
+	p->ver = 0;
+	p->recs = NULL;
+	p->n_recs = 0;
+	p->cap_recs = 0;
+	p->stamps = NULL;
+	p->worker = NULL;
+	p->n_threads = 1;
+	p->n_memo = exprs->n_exprs;
 	p->params = (param_t *) calloc(p->cap, sizeof(param_t));
-	if (!p->params) {
+	p->memo = (expr_memo_t *) calloc(p->n_memo + 1, sizeof(expr_memo_t));
+	p->memo_deps = (unsigned long *) calloc(exprs->n_deps + 1,
+		sizeof(unsigned long));
+	if (!p->params || !p->memo || !p->memo_deps) {
+		free(p->params);
+		free(p->memo);
+		free(p->memo_deps);
 		free(p);
 		return NULL;
 	}
 	return p;
 }
 
+/* makes the newest entry the one that gives its name a value */
+static void
+param_stack_bind (param_stack_t *p)
+{
+	param_t *param = &p->params[p->n];
+	expr_cache_t *c = p->exprs;
+	param->slot = str_pool_find(c->names, param->name);
+	if (param->slot >= 0) {
+		param->prev = c->scope[param->slot];
+		c->scope[param->slot] = p->n;
+		c->values[param->slot] = param->value;
+	}
+	p->n++;
+}
+
 void
 param_stack_leave (param_stack_t *p)
 {
-	p->n--;
+	param_t *param = &p->params[--p->n];
+	expr_cache_t *c = p->exprs;
+	if (param->slot >= 0) {
+		c->scope[param->slot] = param->prev;
+		if (param->prev >= 0)
+			c->values[param->slot] = p->params[param->prev].value;
+	}
+}
+
+/* An expression that does not refer to the variable of its innermost
+ * loop mostly sees the same values again: the parameters of every
+ * instance of a module are computed from the ones of the network, and
+ * the indices of an outer loop stay while an inner loop runs.  Its value
+ * is kept in the memo with the versions of the bindings it was computed
+ * from, and reused, version included, while these bindings have not
+ * changed. */
+/* the version of the value of slot, 0 if a builtin stands for it */
+static unsigned long
+param_stack_slot_ver (param_stack_t *p, expr_cache_t *c, int slot)
+{
+	return (c->scope[slot] < 0) ? 0 : p->params[c->scope[slot]].ver;
+}
+
+static bool
+param_stack_memo_valid (param_stack_t *p, expr_t *x)
+{
+	expr_cache_t *c = p->exprs;
+	unsigned long *deps = &p->memo_deps[x->deps];
+	if (!p->memo[x->id].ver)
+		return false;
+	for (int i = 0; i < x->n_slots; i++)
+		if (param_stack_slot_ver(p, c, x->slots[i]) != deps[i])
+			return false;
+	return true;
+}
+
+static void
+param_stack_memo_set (param_stack_t *p, expr_t *x, double value,
+	unsigned long ver)
+{
+	expr_cache_t *c = p->exprs;
+	unsigned long *deps = &p->memo_deps[x->deps];
+	p->memo[x->id].value = value;
+	p->memo[x->id].ver = ver;
+	for (int i = 0; i < x->n_slots; i++)
+		deps[i] = param_stack_slot_ver(p, c, x->slots[i]);
 }
 
 static int
-param_stack_to_te_vars (param_stack_t *p, te_variable **vars)
-{
-	int VARS_BLK_SIZE = 32;
-	int te_vars_n = 0;
-	int te_vars_cap = VARS_BLK_SIZE;
-	*vars = (te_variable *) calloc(te_vars_cap, sizeof(te_variable));
-	if (*vars == NULL)
-		return -1;
-
-	/* add starting from the tail -- from the most recent */
-	for (int i = p->n - 1; i >= 0; i--) {
-		bool is_present = false;
-		int param_name_len = strlen(p->params[i].name);
-		for (int j = 0; j < te_vars_n; j++) {
-			if (strncmp(p->params[i].name, (*vars)[j].name,
-				param_name_len) == 0)
+param_rec_add (param_rec_t *rec, int slot, double value)
+{
+	for (int i = 0; i < rec->n_reads; i++)
+		if (rec->reads[i].slot == slot)
+			return 0;
+	if (rec->n_reads == rec->cap_reads) {
+		int cap_reads = rec->cap_reads ? 2 * rec->cap_reads :
+			PARAM_REC_BLK_SIZE;
+		param_read_t *reads = (param_read_t *) realloc(rec->reads,
+			cap_reads * sizeof(param_read_t));
+		if (!reads)
+			return TOP_E_ALLOC;
+		rec->reads = reads;
+		rec->cap_reads = cap_reads;
+	}
+	rec->reads[rec->n_reads].slot = slot;
+	rec->reads[rec->n_reads].value = value;
+	rec->n_reads++;
+	return 0;
+}
+
+/* Records the reads of the given slots with every recorder they are
+ * outside of.  The marks of the recorders grow with their depth, so the
+ * walk stops at the first recorder that all the slots are inside of. */
+static int
+param_stack_rec (param_stack_t *p, const int *slots, int n_slots)
+{
+	expr_cache_t *c = p->exprs;
+	for (int r = p->n_recs - 1; r >= 0; r--) {
+		bool outside = false;
+		for (int i = 0; i < n_slots; i++) {
+			if (c->scope[slots[i]] >= p->recs[r].mark)
+				continue;
+			/* a builtin read for an unbound name matches no
+			 * value */
+			outside = true;
+			if (param_rec_add(&p->recs[r], slots[i],
+				(c->scope[slots[i]] < 0) ? NAN :
+				c->values[slots[i]]))
 			{
-				is_present = true;
-				break;
+				return TOP_E_ALLOC;
 			}
 		}
-		if (is_present) {
-			continue;
-		}
-		if (te_vars_n == te_vars_cap) {
-			te_vars_cap += VARS_BLK_SIZE;
-			*vars = (te_variable *) realloc(*vars,
-				te_vars_cap * sizeof(te_variable));
-			if (*vars == NULL)
-				return -1;
-		}
-		(*vars)[te_vars_n].name = p->params[i].name;
-		(*vars)[te_vars_n].address = &p->params[i].value;
-		te_vars_n++;
+		if (!outside)
+			break;
 	}
+	return 0;
+}
 
-	return te_vars_n;
+/* starts recording the values that are read from the bindings there
+ * are now */
+int
+param_stack_rec_begin (param_stack_t *p)
+{
+	if (p->n_recs == p->cap_recs) {
+		int cap_recs = p->cap_recs ? 2 * p->cap_recs :
+			PARAM_REC_BLK_SIZE;
+		param_rec_t *recs = (param_rec_t *) realloc(p->recs,
+			cap_recs * sizeof(param_rec_t));
+		if (!recs)
+			return TOP_E_ALLOC;
+		p->recs = recs;
+		p->cap_recs = cap_recs;
+	}
+	p->recs[p->n_recs].mark = p->n;
+	p->recs[p->n_recs].reads = NULL;
+	p->recs[p->n_recs].n_reads = 0;
+	p->recs[p->n_recs].cap_reads = 0;
+	p->n_recs++;
+	return 0;
+}
+
+/* stops the last recording and hands its reads over to the caller */
+void
+param_stack_rec_end (param_stack_t *p, param_read_t **r_reads,
+	int *r_n_reads)
+{
+	param_rec_t *rec = &p->recs[--p->n_recs];
+	*r_reads = rec->reads;
+	*r_n_reads = rec->n_reads;
 }
 
+/* records reads of the slots in reads as if they were made now, for a
+ * part of the expansion that was copied instead of done */
 int
-param_stack_eval (param_stack_t *p, char *value, double *rval,
-	char *e_text, size_t e_size)
+param_stack_rec_reads (param_stack_t *p, param_read_t *reads, int n_reads)
 {
-	te_variable *vars = NULL;
-	int vars_n = param_stack_to_te_vars(p, &vars);
-	if (vars_n < 0)
-		return return_error(e_text, e_size, TOP_E_ALLOC, "");
-	int err;
-	te_expr *e = te_compile(value, vars, vars_n, &err);
-	if (e == NULL) {
+	for (int i = 0; i < n_reads; i++) {
+		if (param_stack_rec(p, &reads[i].slot, 1))
+			return TOP_E_ALLOC;
+	}
+	return 0;
+}
+
+static int
+param_stack_eval_ver (param_stack_t *p, char *value, double *rval,
+	unsigned long *ver, char *e_text, size_t e_size)
+{
+	expr_t *x;
+	int res;
+	if ((res = expr_cache_get(p->exprs, value, &x)) == TOP_E_EVAL)
+		return return_error(e_text, e_size, TOP_E_EVAL, ": %s", value);
+	else if (res)
+		return return_error(e_text, e_size, res, "");
+	if (!expr_cache_bound(p->exprs, x))
 		return return_error(e_text, e_size, TOP_E_EVAL, ": %s", value);
+	if (p->n_recs && param_stack_rec(p, x->slots, x->n_slots))
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	/* expressions compiled after the stack was created have no memo */
+	bool memo = !x->varying && x->id < p->n_memo;
+	if (memo && param_stack_memo_valid(p, x)) {
+		*rval = p->memo[x->id].value;
+		*ver = p->memo[x->id].ver;
+		return 0;
 	}
-	*rval = te_eval(e);
-	te_free(e);
-	free(vars);
+	if (!expr_cache_eval(p->exprs, x, rval))
+		return return_error(e_text, e_size, TOP_E_EVAL, ": %s", value);
+	*ver = ++p->ver;
+	if (memo)
+		param_stack_memo_set(p, x, *rval, *ver);
 	return 0;
 }
 
+int
+param_stack_eval (param_stack_t *p, char *value, double *rval,
+	char *e_text, size_t e_size)
+{
+	unsigned long ver;
+	return param_stack_eval_ver(p, value, rval, &ver, e_text, e_size);
+}
+
 int
 param_stack_enter (param_stack_t *p, raw_param_t *r, char *e_text, size_t e_size)
 {
@@ -105,12 +253,12 @@ param_stack_enter (param_stack_t *p, raw_param_t *r, char *e_text, size_t e_size
 
 	/* param stack's lifetime is contained in raw params' lifetime */
 	p->params[p->n].name = r->name;
-	if ((res = param_stack_eval(p, r->value, &p->params[p->n].value,
-		e_text, e_size)))
+	if ((res = param_stack_eval_ver(p, r->value, &p->params[p->n].value,
+		&p->params[p->n].ver, e_text, e_size)))
 	{
 		return res;
 	}
-	p->n++;
+	param_stack_bind(p);
 	return 0;
 }
 
@@ -128,14 +276,70 @@ param_stack_enter_val (param_stack_t *p, char *name, int d)
 	/* param stack's lifetime is contained in name's lifetime */
 	p->params[p->n].name = name;
 	p->params[p->n].value = d;
-	p->n++;
+	p->params[p->n].ver = ++p->ver;
+	param_stack_bind(p);
 	return 0;
 }
 
+/* enters the bindings params of a stack, possibly over another cache of
+ * the same definition, in the same order, so that the same names are in
+ * scope with the same values */
+int
+param_stack_enter_all (param_stack_t *p, param_t *params, int n_params)
+{
+	for (int i = 0; i < n_params; i++) {
+		if (p->n == p->cap) {
+			p->cap += PARAM_BLK_SIZE;
+			p->params = (param_t *) realloc(p->params,
+				p->cap * sizeof(param_t));
+			if (!p->params)
+				return TOP_E_ALLOC;
+		}
+		p->params[p->n].name = params[i].name;
+		p->params[p->n].value = params[i].value;
+		p->params[p->n].ver = ++p->ver;
+		param_stack_bind(p);
+	}
+	return 0;
+}
+
+/* Unbinds the entries there are, but keeps them, so that the entries
+ * made next are the only ones in scope.  They are bound again by
+ * param_stack_show once these are left. */
+void
+param_stack_hide (param_stack_t *p)
+{
+	expr_cache_t *c = p->exprs;
+	for (int i = 0; i < p->n; i++)
+		if (p->params[i].slot >= 0)
+			c->scope[p->params[i].slot] = -1;
+}
+
+void
+param_stack_show (param_stack_t *p)
+{
+	expr_cache_t *c = p->exprs;
+	for (int i = 0; i < p->n; i++) {
+		if (p->params[i].slot >= 0) {
+			c->scope[p->params[i].slot] = i;
+			c->values[p->params[i].slot] = p->params[i].value;
+		}
+	}
+}
+
+/* the entries left are unbound, so that the slots are clean for the next
+ * stack over the same cache */
 void
 param_stack_destroy (param_stack_t *p)
 {
+	while (p->n > 0)
+		param_stack_leave(p);
 	free(p->params);
+	while (p->n_recs > 0)
+		free(p->recs[--p->n_recs].reads);
+	free(p->recs);
+	free(p->memo);
+	free(p->memo_deps);
 	free(p);
 }
 
@@ -148,68 +352,156 @@ param_stack_print (param_stack_t *p, FILE *stream)
 	}
 } */
 
-int
-eval_conn_name (param_stack_t *p, char *name, char **r_name,
-	char *e_text, size_t e_size)
+name_tmpl_t *
+name_tmpl_create (char *name)
 {
-	int len = strlen(name);
-	char *left, *right;
-
-	int n_params = 0;
-	left = name;
-	while ((left = strchr(left, '[')) != NULL) {
-		left++;
-		n_params++;
+	name_tmpl_t *t = (name_tmpl_t *) calloc(1, sizeof(name_tmpl_t));
+	if (!t)
+		return NULL;
+	t->name = name;
+	t->bad = -1;
+	t->text = strdup(name);
+	if (!t->text) {
+		name_tmpl_destroy(t);
+		return NULL;
 	}
 
-	int *eval_res = calloc(n_params, sizeof(int));
-	if (!eval_res)
-		return TOP_E_ALLOC;
-	int i = 0;
-	int added_len = 0;
-	double tmp_d;
-	int res;
+	int n_exprs = 0;
+	for (char *c = name; (c = strchr(c, '[')) != NULL; c++)
+		n_exprs++;
+	t->lits = (char **) malloc((n_exprs + 1) * sizeof(char *));
+	t->lit_lens = (size_t *) malloc((n_exprs + 1) * sizeof(size_t));
+	t->exprs = (char **) malloc((n_exprs + 1) * sizeof(char *));
+	if (!t->lits || !t->lit_lens || !t->exprs) {
+		name_tmpl_destroy(t);
+		return NULL;
+	}
 
-	left = name;
-	while ((left = strchr(left, '[')) != NULL) {
+	/* expressions are cut out of the copy by overwriting their ']' */
+	char *prev = t->text;
+	char *left, *right;
+	while ((left = strchr(prev, '[')) != NULL) {
 		right = strchr(left, ']');
 		if (right == NULL) {
-			free(eval_res);
-			return return_error(e_text, e_size, TOP_E_EVAL, ": %s", left);
+			t->bad = left - t->text;
+			break;
 		}
 		*right = 0;
-		left++;	
-		if ((res = param_stack_eval(p, left, &tmp_d, e_text, e_size))) {
-			free(eval_res);
-			return res;
-		}
-		eval_res[i] = lrint(tmp_d);
-		*right = ']';
-		added_len += snprintf(0, 0, "%d", eval_res[i]);
-		i++;
+		t->lits[t->n_exprs] = prev;
+		t->lit_lens[t->n_exprs] = left - prev + 1;
+		t->exprs[t->n_exprs] = left + 1;
+		t->n_exprs++;
+		prev = right + 1;
 	}
+	t->lits[t->n_exprs] = prev;
+	t->lit_lens[t->n_exprs] = strlen(prev);
+	return t;
+}
+
+static int
+name_tmpl_grow (char **buf, size_t *cap, size_t len)
+{
+	if (len + 1 <= *cap)
+		return 0;
+	size_t new_cap = *cap ? *cap : 32;
+	while (new_cap < len + 1)
+		new_cap *= 2;
+	char *new_buf = (char *) realloc(*buf, new_cap);
+	if (!new_buf)
+		return TOP_E_ALLOC;
+	*buf = new_buf;
+	*cap = new_cap;
+	return 0;
+}
+
+static int
+name_buf_grow (name_buf_t *b, int n_exprs)
+{
+	if (n_exprs <= b->cap_exprs)
+		return 0;
+	size_t *ends = (size_t *) realloc(b->ends, n_exprs * sizeof(size_t));
+	if (!ends)
+		return TOP_E_ALLOC;
+	b->ends = ends;
+	unsigned long *vers = (unsigned long *) realloc(b->vers,
+		n_exprs * sizeof(unsigned long));
+	if (!vers)
+		return TOP_E_ALLOC;
+	b->vers = vers;
+	b->cap_exprs = n_exprs;
+	return 0;
+}
+
+/* writes the name of s, a dot and the name of t with its indices
+ * evaluated to b->buf.  In a loop the indices that do not depend on the
+ * loop variable keep their versions, and the part of the name up to the
+ * first index that changed is left as it is. */
+int
+name_tmpl_eval (param_stack_t *p, name_tmpl_t *t, name_stack_t *s,
+	name_buf_t *b, char *e_text, size_t e_size)
+{
+	/* the longest int and a closing bracket */
+	const size_t int_len = 12;
+	size_t len = s->len + 1;
+	int res;
 
-	char *res_str = calloc(len + added_len + 1, sizeof(char));
-	if (!res_str) {
-		free(eval_res);
+	if (!t)
+		return return_error(e_text, e_size, TOP_E_EVAL, "");
+	if (name_buf_grow(b, t->n_exprs))
 		return TOP_E_ALLOC;
+	if (b->t != t || b->p != p || b->gen != s->gen) {
+		if (name_tmpl_grow(&b->buf, &b->cap, len))
+			return TOP_E_ALLOC;
+		memcpy(b->buf, s->buf, s->len);
+		b->buf[s->len] = '.';
+		b->t = t;
+		b->p = p;
+		b->gen = s->gen;
+		b->n_valid = 0;
 	}
-	char *t = res_str;
-	left = name;
-	char *prev = left;
-	i = 0;
-	while ((left = strchr(left, '[')) != NULL) {
-		strncpy(t, prev, left - prev + 1);
-		t += left - prev + 1;
-		t += snprintf(t, res_str + len + added_len - t, "%d]",
-			eval_res[i]);
-		left = strchr(left, ']');
-		prev = left + 1;
-		i++;
-	}
-	strcpy(t, prev);
-	free(eval_res);
-	*r_name = res_str;
+	for (int i = 0; i < t->n_exprs; i++) {
+		double tmp_d;
+		unsigned long ver;
+		if ((res = param_stack_eval_ver(p, t->exprs[i], &tmp_d, &ver,
+			e_text, e_size)))
+		{
+			return res;
+		}
+		if (i < b->n_valid && b->vers[i] == ver) {
+			len = b->ends[i];
+			continue;
+		}
+		b->n_valid = i;
+		if (name_tmpl_grow(&b->buf, &b->cap,
+			len + t->lit_lens[i] + int_len))
+		{
+			return TOP_E_ALLOC;
+		}
+		memcpy(b->buf + len, t->lits[i], t->lit_lens[i]);
+		len += t->lit_lens[i];
+		len += sprintf(b->buf + len, "%d]", (int) lrint(tmp_d));
+		b->ends[i] = len;
+		b->vers[i] = ver;
+		b->n_valid = i + 1;
+	}
+	if (t->bad >= 0)
+		return return_error(e_text, e_size, TOP_E_EVAL, ": %s",
+			t->name + t->bad);
+	size_t tail_len = t->lit_lens[t->n_exprs];
+	if (name_tmpl_grow(&b->buf, &b->cap, len + tail_len))
+		return TOP_E_ALLOC;
+	memcpy(b->buf + len, t->lits[t->n_exprs], tail_len + 1);
 	return 0;
 }
 
+void
+name_tmpl_destroy (name_tmpl_t *t)
+{
+	if (!t)
+		return;
+	free(t->text);
+	free(t->lits);
+	free(t->lit_lens);
+	free(t->exprs);
+	free(t);
+}
@@ -2,7 +2,7 @@
 # define PARAM_STACK_H
 
 param_stack_t *
-param_stack_create (void);
+param_stack_create (expr_cache_t *exprs);
 
 void
 param_stack_leave (param_stack_t *p);
@@ -18,14 +18,39 @@ param_stack_enter (param_stack_t *p, raw_param_t *r, char *e_text,
 int
 param_stack_enter_val (param_stack_t *p, char *name, int d);
 
+int
+param_stack_enter_all (param_stack_t *p, param_t *params, int n_params);
+
+void
+param_stack_hide (param_stack_t *p);
+
+void
+param_stack_show (param_stack_t *p);
+
+int
+param_stack_rec_begin (param_stack_t *p);
+
+void
+param_stack_rec_end (param_stack_t *p, param_read_t **r_reads,
+	int *r_n_reads);
+
+int
+param_stack_rec_reads (param_stack_t *p, param_read_t *reads, int n_reads);
+
 void
 param_stack_destroy (param_stack_t *p);
 
 /* void
 param_stack_print (param_stack_t *p, FILE *stream); */
 
+name_tmpl_t *
+name_tmpl_create (char *name);
+
 int
-eval_conn_name (param_stack_t *p, char *name, char **r_name,
-	char *e_text, size_t e_size);
+name_tmpl_eval (param_stack_t *p, name_tmpl_t *t, name_stack_t *s,
+	name_buf_t *b, char *e_text, size_t e_size);
+
+void
+name_tmpl_destroy (name_tmpl_t *t);
 
 #endif
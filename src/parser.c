@@ -5,6 +5,7 @@
 #include <string.h>
 
 #include "parser.h"
+#include "param_stack.h"
 #include "jsmn.h"
 #include "defs.h"
 #include "errors.h"
@@ -588,6 +589,48 @@ parse_replace (int subobj_n, jsmntok_t *tokens, char *text,
 }
 
 
+/* splits the endpoint names into templates once, so that expanding the
+ * connection only evaluates the indices */
+static int
+parse_connection_names (connection_wrapper_t *connection)
+{
+	char *nodes = NULL;
+	name_tmpl_t **nodes_tmpl = NULL;
+	switch (connection->type) {
+	case CONN_HAS_CONN:
+		if (connection->ptr.conn->from &&
+			!(connection->ptr.conn->from_tmpl =
+			name_tmpl_create(connection->ptr.conn->from)))
+		{
+			return TOP_E_ALLOC;
+		}
+		if (connection->ptr.conn->to &&
+			!(connection->ptr.conn->to_tmpl =
+			name_tmpl_create(connection->ptr.conn->to)))
+		{
+			return TOP_E_ALLOC;
+		}
+		return 0;
+	case CONN_HAS_LINE:
+		nodes = connection->ptr.line->nodes;
+		nodes_tmpl = &connection->ptr.line->nodes_tmpl;
+		break;
+	case CONN_HAS_RING:
+		nodes = connection->ptr.ring->nodes;
+		nodes_tmpl = &connection->ptr.ring->nodes_tmpl;
+		break;
+	case CONN_HAS_ALLLIST:
+		nodes = connection->ptr.alllist->nodes;
+		nodes_tmpl = &connection->ptr.alllist->nodes_tmpl;
+		break;
+	default:
+		return 0;
+	}
+	if (nodes && !(*nodes_tmpl = name_tmpl_create(nodes)))
+		return TOP_E_ALLOC;
+	return 0;
+}
+
 static int
 parse_connection (int subobj_n, jsmntok_t *tokens, char *text,
 	connection_wrapper_t *connection, int *i,
@@ -977,6 +1020,8 @@ parse_connection (int subobj_n, jsmntok_t *tokens, char *text,
 	} else {
 		return bad_token(*i, &tokens[*i], text, state, e_text, e_size);
 	}
+	if (parse_connection_names(connection))
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 	return 0;
 }
 
@@ -18,15 +18,157 @@
 #include "graph.h"
 #include "topologies.h"
 #include "products.h"
+#include "name_trie.h"
 #include "errors.h"
 
+/* full names of the nodes of g, in one block */
+static char **
+prod_names (graph_t *g)
+{
+	size_t size = g->n_nodes * sizeof(char *);
+	for (graph_id_t i = 0; i < g->n_nodes; i++)
+		size += name_trie_len(g->names, g->name_ids[i]) + 1;
+	char **names = malloc(size ? size : 1);
+	if (!names)
+		return NULL;
+	char *buf = (char *) (names + g->n_nodes);
+	for (graph_id_t i = 0; i < g->n_nodes; i++) {
+		names[i] = name_trie_str(g->names, g->name_ids[i], buf);
+		buf += name_trie_len(g->names, g->name_ids[i]) + 1;
+	}
+	return names;
+}
+
+static int
+prod_attrs_init (prod_attrs_t *pa, graph_t *g_a, graph_t *g_b,
+	graph_t *g_prod)
+{
+	pa->names_a = prod_names(g_a);
+	pa->names_b = prod_names(g_b);
+	pa->map_a = malloc((g_a->attrs->n_strs + 1) * sizeof(int));
+	pa->map_b = malloc((g_b->attrs->n_strs + 1) * sizeof(int));
+	pa->n_pairs = 0;
+	pa->cap_pairs = 32;
+	pa->pairs = malloc(3 * pa->cap_pairs * sizeof(int));
+	if (!pa->names_a || !pa->names_b || !pa->map_a || !pa->map_b ||
+		!pa->pairs)
+	{
+		return TOP_E_ALLOC;
+	}
+	memset(pa->pairs, -1, 3 * pa->cap_pairs * sizeof(int));
+	pa->map_a[0] = 0;
+	for (graph_id_t i = 0; i < g_a->attrs->n_strs; i++) {
+		if (graph_attr_id(g_prod, g_a->attrs->strs[i], &pa->map_a[i + 1]))
+			return TOP_E_ALLOC;
+	}
+	pa->map_b[0] = 0;
+	for (graph_id_t i = 0; i < g_b->attrs->n_strs; i++) {
+		if (graph_attr_id(g_prod, g_b->attrs->strs[i], &pa->map_b[i + 1]))
+			return TOP_E_ALLOC;
+	}
+	return 0;
+}
+
+static void
+prod_attrs_free (prod_attrs_t *pa)
+{
+	free(pa->names_a);
+	free(pa->names_b);
+	free(pa->map_a);
+	free(pa->map_b);
+	free(pa->pairs);
+}
+
+static int
+prod_attr_a (prod_attrs_t *pa, int a)
+{
+	return pa->map_a[a];
+}
+
+static int
+prod_attr_b (prod_attrs_t *pa, int b)
+{
+	return pa->map_b[b];
+}
+
+static int
+prod_attrs_grow (prod_attrs_t *pa)
+{
+	int cap_pairs = 2 * pa->cap_pairs;
+	int *pairs = malloc(3 * cap_pairs * sizeof(int));
+	if (!pairs)
+		return TOP_E_ALLOC;
+	memset(pairs, -1, 3 * cap_pairs * sizeof(int));
+	for (int i = 0; i < pa->cap_pairs; i++) {
+		int *e = &pa->pairs[3 * i];
+		if (e[2] < 0)
+			continue;
+		unsigned k = ((unsigned) e[0] * 31 + e[1]) & (cap_pairs - 1);
+		while (pairs[3 * k + 2] >= 0)
+			k = (k + 1) & (cap_pairs - 1);
+		memcpy(&pairs[3 * k], e, 3 * sizeof(int));
+	}
+	free(pa->pairs);
+	pa->pairs = pairs;
+	pa->cap_pairs = cap_pairs;
+	return 0;
+}
+
+/* attribute of a product element built from factor attributes a and b:
+ * "a, b" if both are present, otherwise whichever one is */
+static int
+prod_attr (prod_attrs_t *pa, graph_t *g_a, int a, graph_t *g_b, int b,
+	graph_t *g_prod, int *r_attr)
+{
+	if ((a == 0) || (b == 0)) {
+		*r_attr = (a == 0) ? prod_attr_b(pa, b) : prod_attr_a(pa, a);
+		return 0;
+	}
+	unsigned k = ((unsigned) a * 31 + b) & (pa->cap_pairs - 1);
+	for (; pa->pairs[3 * k + 2] >= 0; k = (k + 1) & (pa->cap_pairs - 1)) {
+		if ((pa->pairs[3 * k] == a) && (pa->pairs[3 * k + 1] == b)) {
+			*r_attr = pa->pairs[3 * k + 2];
+			return 0;
+		}
+	}
+
+	char *attr_a = graph_attr(g_a, a);
+	char *attr_b = graph_attr(g_b, b);
+	char *attrs = malloc(strlen(attr_a) + strlen(attr_b) + 3);
+	if (!attrs)
+		return TOP_E_ALLOC;
+	sprintf(attrs, "%s, %s", attr_a, attr_b);
+	int res = graph_attr_id(g_prod, attrs, r_attr);
+	free(attrs);
+	if (res)
+		return res;
+
+	pa->pairs[3 * k] = a;
+	pa->pairs[3 * k + 1] = b;
+	pa->pairs[3 * k + 2] = *r_attr;
+	pa->n_pairs++;
+	if (2 * pa->n_pairs > pa->cap_pairs)
+		return prod_attrs_grow(pa);
+	return 0;
+}
+
 static int
 graphs_cart_product_nodes (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
-	int *r_name_buf_cap, int *r_name_buf_neigh_cap,
+	prod_attrs_t *pa, int *r_name_buf_cap, int *r_name_buf_neigh_cap,
 	char *e_text, size_t e_size)
 {
 	int res;
 	int name_len;
+
+	/* every pair of nodes becomes a node of the product */
+	graph_id_t n_a = graph_count_nodes(g_a);
+	graph_id_t n_b = graph_count_nodes(g_b);
+	if ((n_a > 0) && (n_b <= (GRAPH_ID_MAX - g_prod->n_nodes) / n_a) &&
+		graph_reserve(g_prod, g_prod->n_nodes + n_a * n_b, 0))
+	{
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+
 	int name_buf_blk = 32;
 	int name_buf_cap = name_buf_blk;
 	char *name_buf = malloc(name_buf_cap);
@@ -37,13 +179,14 @@ graphs_cart_product_nodes (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	if (!name_buf_neigh)
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 
-	for (int i = 0; i < g_a->n_nodes; i++) {
-		if (g_a->nodes[i].type != NODE_NODE) continue;
-		for (int j = 0; j < g_b->n_nodes; j++) {
-			if (g_b->nodes[j].type != NODE_NODE) continue;
-
-			name_len = strlen(g_a->nodes[i].name) +
-				strlen(g_b->nodes[j].name) + 4;
+	for (graph_id_t i = graph_next_node(g_a, 0); i < g_a->n_nodes;
+		i = graph_next_node(g_a, i + 1))
+	{
+		for (graph_id_t j = graph_next_node(g_b, 0); j < g_b->n_nodes;
+			j = graph_next_node(g_b, j + 1))
+		{
+			name_len = strlen(pa->names_a[i]) +
+				strlen(pa->names_b[j]) + 4;
 			if (name_buf_cap < name_len) {
 				name_buf_cap = (1 + name_len / name_buf_blk) *
 					name_buf_blk;
@@ -54,35 +197,22 @@ graphs_cart_product_nodes (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 				}
 			}
 
-			sprintf(name_buf, "(%s,%s)", g_a->nodes[i].name,
-				g_b->nodes[j].name);
-			char *attrs;
-			if (g_a->nodes[i].attributes &&
-				g_b->nodes[j].attributes)
+			sprintf(name_buf, "(%s,%s)", pa->names_a[i],
+				pa->names_b[j]);
+			int attr;
+			if (prod_attr(pa, g_a, g_a->nodes[i].attr,
+				g_b, g_b->nodes[j].attr, g_prod, &attr))
 			{
-				int attrs_len = strlen(g_a->nodes[i].attributes) +
-					strlen(g_b->nodes[j].attributes) + 3;
-				attrs = malloc(attrs_len);
-				if (!attrs)
-					return return_error(e_text, e_size, TOP_E_ALLOC, "");
-				sprintf(attrs, "%s, %s",
-					g_a->nodes[i].attributes,
-					g_b->nodes[j].attributes);
-			} else if (g_a->nodes[i].attributes) {
-				attrs = g_a->nodes[i].attributes;
-			} else {
-				attrs = g_b->nodes[j].attributes;
+				return return_error(e_text, e_size, TOP_E_ALLOC, "");
 			}
-			if (graph_add_node(g_prod, name_buf, NODE_NODE, attrs))
+			if (graph_add_node(g_prod, name_buf, NODE_NODE, attr))
 				return return_error(e_text, e_size, TOP_E_ALLOC, "");
-			if (g_a->nodes[i].attributes && g_b->nodes[j].attributes)
-				free(attrs);
 
-			for (int k = 0; k < g_a->nodes[i].n_adj; k++) {
-				if (g_a->nodes[g_a->nodes[i].adj[k].n].type != NODE_GATE)
+			for (graph_id_t k = 0; k < g_a->nodes[i].n_adj; k++) {
+				if (g_a->types[g_a->nodes[i].adj[k].n] != NODE_GATE)
 					continue;
 				name_len = strlen(name_buf) +
-					strlen(g_a->nodes[g_a->nodes[i].adj[k].n].name) + 2;
+					strlen(pa->names_a[g_a->nodes[i].adj[k].n]) + 2;
 				if (name_buf_neigh_cap < name_len) {
 					name_buf_neigh_cap = (1 + name_len / name_buf_blk) *
 						name_buf_blk;
@@ -94,12 +224,12 @@ graphs_cart_product_nodes (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 					}
 				}
 				sprintf(name_buf_neigh, "%s.%s", name_buf,
-					g_a->nodes[g_a->nodes[i].adj[k].n].name);
-				if (graph_add_node(g_prod, name_buf_neigh, NODE_GATE, NULL))
+					pa->names_a[g_a->nodes[i].adj[k].n]);
+				if (graph_add_node(g_prod, name_buf_neigh, NODE_GATE, 0))
 					return return_error(e_text, e_size, TOP_E_ALLOC, "");
 				if ((res = graph_add_edge_name(g_prod, name_buf,
 					name_buf_neigh,
-					g_a->nodes[i].adj[k].attributes)))
+					prod_attr_a(pa, g_a->nodes[i].adj[k].attr))))
 				{
 					if (res == TOP_E_CONN) {
 						return_error(e_text, e_size, TOP_E_CONN,
@@ -111,11 +241,11 @@ graphs_cart_product_nodes (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 				}
 			}
 
-			for (int k = 0; k < g_b->nodes[j].n_adj; k++) {
-				if (g_b->nodes[g_b->nodes[j].adj[k].n].type != NODE_GATE)
+			for (graph_id_t k = 0; k < g_b->nodes[j].n_adj; k++) {
+				if (g_b->types[g_b->nodes[j].adj[k].n] != NODE_GATE)
 					continue;
 				name_len = strlen(name_buf) +
-					strlen(g_b->nodes[g_b->nodes[j].adj[k].n].name) + 2;
+					strlen(pa->names_b[g_b->nodes[j].adj[k].n]) + 2;
 				if (name_buf_neigh_cap < name_len) {
 					name_buf_neigh_cap = (1 + name_len / name_buf_blk) *
 						name_buf_blk;
@@ -127,12 +257,12 @@ graphs_cart_product_nodes (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 					}
 				}
 				sprintf(name_buf_neigh, "%s.%s", name_buf,
-					g_b->nodes[g_b->nodes[j].adj[k].n].name);
-				if (graph_add_node(g_prod, name_buf_neigh, NODE_GATE, NULL))
+					pa->names_b[g_b->nodes[j].adj[k].n]);
+				if (graph_add_node(g_prod, name_buf_neigh, NODE_GATE, 0))
 					return return_error(e_text, e_size, TOP_E_ALLOC, "");
 				if ((res = graph_add_edge_name(g_prod, name_buf,
 					name_buf_neigh,
-					g_b->nodes[j].adj[k].attributes)))
+					prod_attr_b(pa, g_b->nodes[j].adj[k].attr))))
 				{
 					if (res == TOP_E_CONN) {
 						return_error(e_text, e_size, TOP_E_CONN,
@@ -163,7 +293,12 @@ graphs_cart_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	int name_buf_cap = name_buf_blk;
 	int name_buf_neigh_cap = name_buf_blk;
 
-	graphs_cart_product_nodes(g_a, g_b, g_prod, &name_buf_cap,
+	prod_attrs_t pa_s, *pa = &pa_s;
+	if (prod_attrs_init(pa, g_a, g_b, g_prod)) {
+		prod_attrs_free(pa);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	graphs_cart_product_nodes(g_a, g_b, g_prod, pa, &name_buf_cap,
 		&name_buf_neigh_cap, e_text, e_size);
 
 	char *name_buf = malloc(name_buf_cap);
@@ -175,26 +310,27 @@ graphs_cart_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	if (!name_buf_neigh)
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 
-	for (int i = 0; i < g_a->n_nodes; i++) {
-		if (g_a->nodes[i].type != NODE_NODE) continue;
-		for (int j = 0; j < g_b->n_nodes; j++) {
-			if (g_b->nodes[j].type != NODE_NODE) continue;
-
-			sprintf(name_buf, "(%s,%s)", g_a->nodes[i].name,
-				g_b->nodes[j].name);
-
-			for (int k = 0; k < g_a->nodes[i].n_adj; k++) {
-				if (g_a->nodes[g_a->nodes[i].adj[k].n].type != NODE_NODE)
+	for (graph_id_t i = graph_next_node(g_a, 0); i < g_a->n_nodes;
+		i = graph_next_node(g_a, i + 1))
+	{
+		for (graph_id_t j = graph_next_node(g_b, 0); j < g_b->n_nodes;
+			j = graph_next_node(g_b, j + 1))
+		{
+			sprintf(name_buf, "(%s,%s)", pa->names_a[i],
+				pa->names_b[j]);
+
+			for (graph_id_t k = 0; k < g_a->nodes[i].n_adj; k++) {
+				if (g_a->types[g_a->nodes[i].adj[k].n] != NODE_NODE)
 					continue;
 				if (g_a->nodes[i].adj[k].n < i) continue;
 
 				sprintf(name_buf_neigh, "(%s,%s)",
-					g_a->nodes[g_a->nodes[i].adj[k].n].name,
-					g_b->nodes[j].name);
+					pa->names_a[g_a->nodes[i].adj[k].n],
+					pa->names_b[j]);
 
 				if ((res = graph_add_edge_name(g_prod, name_buf,
 					name_buf_neigh,
-					g_a->nodes[i].adj[k].attributes)))
+					prod_attr_a(pa, g_a->nodes[i].adj[k].attr))))
 				{
 					if (res == TOP_E_CONN) {
 						return_error(e_text, e_size, TOP_E_CONN,
@@ -206,18 +342,18 @@ graphs_cart_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 				}
 			}
 
-			for (int k = 0; k < g_b->nodes[j].n_adj; k++) {
-				if (g_b->nodes[g_b->nodes[j].adj[k].n].type != NODE_NODE)
+			for (graph_id_t k = 0; k < g_b->nodes[j].n_adj; k++) {
+				if (g_b->types[g_b->nodes[j].adj[k].n] != NODE_NODE)
 					continue;
 				if (g_b->nodes[j].adj[k].n < j) continue;
 
 				sprintf(name_buf_neigh, "(%s,%s)",
-					g_a->nodes[i].name,
-					g_b->nodes[g_b->nodes[j].adj[k].n].name);
+					pa->names_a[i],
+					pa->names_b[g_b->nodes[j].adj[k].n]);
 
 				if ((res = graph_add_edge_name(g_prod, name_buf,
 					name_buf_neigh,
-					g_b->nodes[j].adj[k].attributes)))
+					prod_attr_b(pa, g_b->nodes[j].adj[k].attr))))
 				{
 					if (res == TOP_E_CONN) {
 						return_error(e_text, e_size, TOP_E_CONN,
@@ -231,6 +367,7 @@ graphs_cart_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 		}
 	}
 
+	prod_attrs_free(pa);
 	free(name_buf);
 	free(name_buf_neigh);
 	return 0;
@@ -245,7 +382,12 @@ graphs_tens_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	int name_buf_cap = name_buf_blk;
 	int name_buf_neigh_cap = name_buf_blk;
 
-	graphs_cart_product_nodes(g_a, g_b, g_prod, &name_buf_cap,
+	prod_attrs_t pa_s, *pa = &pa_s;
+	if (prod_attrs_init(pa, g_a, g_b, g_prod)) {
+		prod_attrs_free(pa);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	graphs_cart_product_nodes(g_a, g_b, g_prod, pa, &name_buf_cap,
 		&name_buf_neigh_cap, e_text, e_size);
 
 	char *name_buf = malloc(name_buf_cap);
@@ -257,44 +399,33 @@ graphs_tens_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	if (!name_buf_neigh)
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 
-	for (int i = 0; i < g_a->n_nodes; i++) {
-		if (g_a->nodes[i].type != NODE_NODE) continue;
-		for (int j = 0; j < g_b->n_nodes; j++) {
-			if (g_b->nodes[j].type != NODE_NODE) continue;
-
-			sprintf(name_buf, "(%s,%s)", g_a->nodes[i].name,
-				g_b->nodes[j].name);
+	for (graph_id_t i = graph_next_node(g_a, 0); i < g_a->n_nodes;
+		i = graph_next_node(g_a, i + 1))
+	{
+		for (graph_id_t j = graph_next_node(g_b, 0); j < g_b->n_nodes;
+			j = graph_next_node(g_b, j + 1))
+		{
+			sprintf(name_buf, "(%s,%s)", pa->names_a[i],
+				pa->names_b[j]);
 
-			for (int k = 0; k < g_a->nodes[i].n_adj; k++) {
-				if (g_a->nodes[g_a->nodes[i].adj[k].n].type != NODE_NODE) continue;
-				for (int l = 0; l < g_b->nodes[j].n_adj; l++) {
-					if (g_b->nodes[g_b->nodes[j].adj[k].n].type != NODE_NODE) continue;
+			for (graph_id_t k = 0; k < g_a->nodes[i].n_adj; k++) {
+				if (g_a->types[g_a->nodes[i].adj[k].n] != NODE_NODE) continue;
+				for (graph_id_t l = 0; l < g_b->nodes[j].n_adj; l++) {
+					if (g_b->types[g_b->nodes[j].adj[k].n] != NODE_NODE) continue;
 
 					sprintf(name_buf_neigh, "(%s,%s)",
-						g_a->nodes[g_a->nodes[i].adj[k].n].name,
-						g_b->nodes[g_b->nodes[j].adj[l].n].name);
+						pa->names_a[g_a->nodes[i].adj[k].n],
+						pa->names_b[g_b->nodes[j].adj[l].n]);
 
-					char *attrs;
-					if (g_a->nodes[i].adj[k].attributes &&
-						g_b->nodes[j].adj[l].attributes)
+					int attr;
+					if (prod_attr(pa, g_a, g_a->nodes[i].adj[k].attr,
+						g_b, g_b->nodes[j].adj[l].attr, g_prod, &attr))
 					{
-						int attrs_len = strlen(g_a->nodes[i].adj[k].attributes) +
-							strlen(g_b->nodes[j].adj[l].attributes) + 3;
-						attrs = malloc(attrs_len);
-						if (!attrs)
-							return return_error(e_text, e_size, TOP_E_ALLOC, "");
-						sprintf(attrs, "%s, %s",
-							g_a->nodes[i].adj[k].attributes,
-							g_b->nodes[j].adj[l].attributes);
-					} else if (g_a->nodes[i].adj[k].attributes) {
-						attrs = g_a->nodes[i].adj[k].attributes;
-					} else {
-						attrs = g_b->nodes[j].adj[l].attributes;
+						return return_error(e_text, e_size, TOP_E_ALLOC, "");
 					}
 
 					if ((res = graph_add_edge_name(g_prod, name_buf,
-						name_buf_neigh,
-						attrs)))
+						name_buf_neigh, attr)))
 					{
 						if (res == TOP_E_CONN) {
 							return_error(e_text, e_size, TOP_E_CONN,
@@ -304,16 +435,12 @@ graphs_tens_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 							return return_error(e_text, e_size, res, "");
 						}
 					}
-					if (g_a->nodes[i].adj[k].attributes &&
-						g_b->nodes[j].adj[l].attributes)
-					{
-						free(attrs);
-					}
 				}
 			}
 		}
 	}
 
+	prod_attrs_free(pa);
 	free(name_buf);
 	free(name_buf_neigh);
 	return 0;
@@ -328,7 +455,12 @@ graphs_lex_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	int name_buf_cap = name_buf_blk;
 	int name_buf_neigh_cap = name_buf_blk;
 
-	graphs_cart_product_nodes(g_a, g_b, g_prod, &name_buf_cap,
+	prod_attrs_t pa_s, *pa = &pa_s;
+	if (prod_attrs_init(pa, g_a, g_b, g_prod)) {
+		prod_attrs_free(pa);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	graphs_cart_product_nodes(g_a, g_b, g_prod, pa, &name_buf_cap,
 		&name_buf_neigh_cap, e_text, e_size);
 
 	char *name_buf = malloc(name_buf_cap);
@@ -340,27 +472,28 @@ graphs_lex_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	if (!name_buf_neigh)
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 
-	for (int i = 0; i < g_a->n_nodes; i++) {
-		if (g_a->nodes[i].type != NODE_NODE) continue;
-		for (int j = 0; j < g_b->n_nodes; j++) {
-			if (g_b->nodes[j].type != NODE_NODE) continue;
-
-			sprintf(name_buf, "(%s,%s)", g_a->nodes[i].name,
-				g_b->nodes[j].name);
+	for (graph_id_t i = graph_next_node(g_a, 0); i < g_a->n_nodes;
+		i = graph_next_node(g_a, i + 1))
+	{
+		for (graph_id_t j = graph_next_node(g_b, 0); j < g_b->n_nodes;
+			j = graph_next_node(g_b, j + 1))
+		{
+			sprintf(name_buf, "(%s,%s)", pa->names_a[i],
+				pa->names_b[j]);
 
-			for (int k = 0; k < g_a->nodes[i].n_adj; k++) {
-				if (g_a->nodes[g_a->nodes[i].adj[k].n].type != NODE_NODE) continue;
+			for (graph_id_t k = 0; k < g_a->nodes[i].n_adj; k++) {
+				if (g_a->types[g_a->nodes[i].adj[k].n] != NODE_NODE) continue;
 
-				for (int l = 0; l < g_b->n_nodes; l++) {
-					if (g_b->nodes[g_b->nodes[j].adj[k].n].type != NODE_NODE) continue;
+				for (graph_id_t l = 0; l < g_b->n_nodes; l++) {
+					if (g_b->types[g_b->nodes[j].adj[k].n] != NODE_NODE) continue;
 
 					sprintf(name_buf_neigh, "(%s,%s)",
-						g_a->nodes[g_a->nodes[i].adj[k].n].name,
-						g_b->nodes[l].name);
+						pa->names_a[g_a->nodes[i].adj[k].n],
+						pa->names_b[l]);
 
 					if ((res = graph_add_edge_name(g_prod, name_buf,
 						name_buf_neigh,
-						g_b->nodes[j].adj[k].attributes)))
+						prod_attr_b(pa, g_b->nodes[j].adj[k].attr))))
 					{
 						if (res == TOP_E_CONN) {
 							return_error(e_text, e_size, TOP_E_CONN,
@@ -373,16 +506,16 @@ graphs_lex_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 				}
 			}
 
-			for (int k = 0; k < g_b->nodes[j].n_adj; k++) {
-				if (g_b->nodes[g_b->nodes[j].adj[k].n].type != NODE_NODE) continue;
+			for (graph_id_t k = 0; k < g_b->nodes[j].n_adj; k++) {
+				if (g_b->types[g_b->nodes[j].adj[k].n] != NODE_NODE) continue;
 
 				sprintf(name_buf_neigh, "(%s,%s)",
-					g_a->nodes[i].name,
-					g_b->nodes[g_b->nodes[j].adj[k].n].name);
+					pa->names_a[i],
+					pa->names_b[g_b->nodes[j].adj[k].n]);
 
 				if ((res = graph_add_edge_name(g_prod, name_buf,
 					name_buf_neigh,
-					g_b->nodes[j].adj[k].attributes)))
+					prod_attr_b(pa, g_b->nodes[j].adj[k].attr))))
 				{
 					if (res == TOP_E_CONN) {
 						return_error(e_text, e_size, TOP_E_CONN,
@@ -396,6 +529,7 @@ graphs_lex_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 		}
 	}
 
+	prod_attrs_free(pa);
 	free(name_buf);
 	free(name_buf_neigh);
 	return 0;
@@ -410,7 +544,12 @@ graphs_strong_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	int name_buf_cap = name_buf_blk;
 	int name_buf_neigh_cap = name_buf_blk;
 
-	graphs_cart_product_nodes(g_a, g_b, g_prod, &name_buf_cap,
+	prod_attrs_t pa_s, *pa = &pa_s;
+	if (prod_attrs_init(pa, g_a, g_b, g_prod)) {
+		prod_attrs_free(pa);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	graphs_cart_product_nodes(g_a, g_b, g_prod, pa, &name_buf_cap,
 		&name_buf_neigh_cap, e_text, e_size);
 
 	char *name_buf = malloc(name_buf_cap);
@@ -422,44 +561,28 @@ graphs_strong_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	if (!name_buf_neigh)
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 
-	for (int i = 0; i < g_a->n_nodes; i++) {
-		if (g_a->nodes[i].type != NODE_NODE) continue;
-		for (int j = 0; j < g_b->n_nodes; j++) {
-			if (g_b->nodes[j].type != NODE_NODE) continue;
-
-			sprintf(name_buf, "(%s,%s)", g_a->nodes[i].name,
-				g_b->nodes[j].name);
+	for (graph_id_t i = graph_next_node(g_a, 0); i < g_a->n_nodes;
+		i = graph_next_node(g_a, i + 1))
+	{
+		for (graph_id_t j = graph_next_node(g_b, 0); j < g_b->n_nodes;
+			j = graph_next_node(g_b, j + 1))
+		{
+			sprintf(name_buf, "(%s,%s)", pa->names_a[i],
+				pa->names_b[j]);
 
-			for (int k = 0; k < g_a->nodes[i].n_adj; k++) {
-				if (g_a->nodes[g_a->nodes[i].adj[k].n].type != NODE_NODE) continue;
-				for (int l = 0; l < g_b->nodes[j].n_adj; l++) {
-					if (g_b->nodes[g_b->nodes[j].adj[k].n].type != NODE_NODE) continue;
+			for (graph_id_t k = 0; k < g_a->nodes[i].n_adj; k++) {
+				if (g_a->types[g_a->nodes[i].adj[k].n] != NODE_NODE) continue;
+				for (graph_id_t l = 0; l < g_b->nodes[j].n_adj; l++) {
+					if (g_b->types[g_b->nodes[j].adj[k].n] != NODE_NODE) continue;
 
 					sprintf(name_buf_neigh, "(%s,%s)",
-						g_a->nodes[g_a->nodes[i].adj[k].n].name,
-						g_b->nodes[g_b->nodes[j].adj[l].n].name);
+						pa->names_a[g_a->nodes[i].adj[k].n],
+						pa->names_b[g_b->nodes[j].adj[l].n]);
 
-					char *attrs;
-					if (g_a->nodes[i].adj[k].attributes &&
-						g_b->nodes[j].adj[l].attributes)
-					{
-						int attrs_len = strlen(g_a->nodes[i].adj[k].attributes) +
-							strlen(g_b->nodes[j].adj[l].attributes) + 3;
-						attrs = malloc(attrs_len);
-						if (!attrs)
-							return return_error(e_text, e_size, TOP_E_ALLOC, "");
-						sprintf(attrs, "%s, %s",
-							g_a->nodes[i].adj[k].attributes,
-							g_b->nodes[j].adj[l].attributes);
-					} else if (g_a->nodes[i].adj[k].attributes) {
-						attrs = g_a->nodes[i].adj[k].attributes;
-					} else {
-						attrs = g_b->nodes[j].adj[l].attributes;
-					}
 
 					if ((res = graph_add_edge_name(g_prod, name_buf,
 						name_buf_neigh,
-						g_b->nodes[j].adj[k].attributes)))
+						prod_attr_b(pa, g_b->nodes[j].adj[k].attr))))
 					{
 						if (res == TOP_E_CONN) {
 							return_error(e_text, e_size, TOP_E_CONN,
@@ -469,36 +592,32 @@ graphs_strong_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 							return return_error(e_text, e_size, res, "");
 						}
 					}
-					if (g_a->nodes[i].adj[k].attributes &&
-						g_b->nodes[j].adj[l].attributes)
-					{
-						free(attrs);
-					}
 				}
 			}
 		}
 	}
 
-	for (int i = 0; i < g_a->n_nodes; i++) {
-		if (g_a->nodes[i].type != NODE_NODE) continue;
-		for (int j = 0; j < g_b->n_nodes; j++) {
-			if (g_b->nodes[j].type != NODE_NODE) continue;
-
-			sprintf(name_buf, "(%s,%s)", g_a->nodes[i].name,
-				g_b->nodes[j].name);
-
-			for (int k = 0; k < g_a->nodes[i].n_adj; k++) {
-				if (g_a->nodes[g_a->nodes[i].adj[k].n].type != NODE_NODE)
+	for (graph_id_t i = graph_next_node(g_a, 0); i < g_a->n_nodes;
+		i = graph_next_node(g_a, i + 1))
+	{
+		for (graph_id_t j = graph_next_node(g_b, 0); j < g_b->n_nodes;
+			j = graph_next_node(g_b, j + 1))
+		{
+			sprintf(name_buf, "(%s,%s)", pa->names_a[i],
+				pa->names_b[j]);
+
+			for (graph_id_t k = 0; k < g_a->nodes[i].n_adj; k++) {
+				if (g_a->types[g_a->nodes[i].adj[k].n] != NODE_NODE)
 					continue;
 				if (g_a->nodes[i].adj[k].n < i) continue;
 
 				sprintf(name_buf_neigh, "(%s,%s)",
-					g_a->nodes[g_a->nodes[i].adj[k].n].name,
-					g_b->nodes[j].name);
+					pa->names_a[g_a->nodes[i].adj[k].n],
+					pa->names_b[j]);
 
 				if ((res = graph_add_edge_name(g_prod, name_buf,
 					name_buf_neigh,
-					g_a->nodes[i].adj[k].attributes)))
+					prod_attr_a(pa, g_a->nodes[i].adj[k].attr))))
 				{
 					if (res == TOP_E_CONN) {
 						return_error(e_text, e_size, TOP_E_CONN,
@@ -510,18 +629,18 @@ graphs_strong_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 				}
 			}
 
-			for (int k = 0; k < g_b->nodes[j].n_adj; k++) {
-				if (g_b->nodes[g_b->nodes[j].adj[k].n].type != NODE_NODE)
+			for (graph_id_t k = 0; k < g_b->nodes[j].n_adj; k++) {
+				if (g_b->types[g_b->nodes[j].adj[k].n] != NODE_NODE)
 					continue;
 				if (g_b->nodes[j].adj[k].n < j) continue;
 
 				sprintf(name_buf_neigh, "(%s,%s)",
-					g_a->nodes[i].name,
-					g_b->nodes[g_b->nodes[j].adj[k].n].name);
+					pa->names_a[i],
+					pa->names_b[g_b->nodes[j].adj[k].n]);
 
 				if ((res = graph_add_edge_name(g_prod, name_buf,
 					name_buf_neigh,
-					g_b->nodes[j].adj[k].attributes)))
+					prod_attr_b(pa, g_b->nodes[j].adj[k].attr))))
 				{
 					if (res == TOP_E_CONN) {
 						return_error(e_text, e_size, TOP_E_CONN,
@@ -536,6 +655,7 @@ graphs_strong_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	}
 
 
+	prod_attrs_free(pa);
 	free(name_buf);
 	free(name_buf_neigh);
 	return 0;
@@ -550,7 +670,12 @@ graphs_root_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	int name_buf_cap = name_buf_blk;
 	int name_buf_neigh_cap = name_buf_blk;
 
-	graphs_cart_product_nodes(g_a, g_b, g_prod, &name_buf_cap,
+	prod_attrs_t pa_s, *pa = &pa_s;
+	if (prod_attrs_init(pa, g_a, g_b, g_prod)) {
+		prod_attrs_free(pa);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	graphs_cart_product_nodes(g_a, g_b, g_prod, pa, &name_buf_cap,
 		&name_buf_neigh_cap, e_text, e_size);
 
 	char *name_buf = malloc(name_buf_cap);
@@ -562,29 +687,29 @@ graphs_root_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 	if (!name_buf_neigh)
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 
-	int root = graph_find_node(g_b, root_name);
+	graph_id_t root = graph_find_node(g_b, root_name);
 	if ((root < 0) ||
-		(g_b->nodes[root].type != NODE_NODE))
+		(g_b->types[root] != NODE_NODE))
 	{
 		return return_error(e_text, e_size, TOP_E_ROOT, " %s", root_name);
 	}
 
-	for (int i = 0; i < g_a->n_nodes; i++) {
-		if (g_a->nodes[i].type != NODE_NODE) continue;
-
-		sprintf(name_buf, "(%s,%s)", g_a->nodes[i].name,
-			g_b->nodes[root].name);
+	for (graph_id_t i = graph_next_node(g_a, 0); i < g_a->n_nodes;
+		i = graph_next_node(g_a, i + 1))
+	{
+		sprintf(name_buf, "(%s,%s)", pa->names_a[i],
+			pa->names_b[root]);
 
-		for (int k = 0; k < g_a->nodes[i].n_adj; k++) {
-			if (g_a->nodes[g_a->nodes[i].adj[k].n].type != NODE_NODE) continue;
+		for (graph_id_t k = 0; k < g_a->nodes[i].n_adj; k++) {
+			if (g_a->types[g_a->nodes[i].adj[k].n] != NODE_NODE) continue;
 
 			sprintf(name_buf_neigh, "(%s,%s)",
-				g_a->nodes[g_a->nodes[i].adj[k].n].name,
-				g_b->nodes[root].name);
+				pa->names_a[g_a->nodes[i].adj[k].n],
+				pa->names_b[root]);
 
 			if ((res = graph_add_edge_name(g_prod, name_buf,
 				name_buf_neigh,
-				g_a->nodes[i].adj[k].attributes)))
+				prod_attr_a(pa, g_a->nodes[i].adj[k].attr))))
 			{
 				if (res == TOP_E_CONN) {
 					return_error(e_text, e_size, TOP_E_CONN,
@@ -597,25 +722,25 @@ graphs_root_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 		}
 	}
 
-	for (int i = 0; i < g_a->n_nodes; i++) {
-		if (g_a->nodes[i].type != NODE_NODE) continue;
-
-		for (int j = 0; j < g_b->n_nodes; j++) {
-			if (g_b->nodes[j].type != NODE_NODE) continue;
-
-			sprintf(name_buf, "(%s,%s)", g_a->nodes[i].name,
-				g_b->nodes[j].name);
+	for (graph_id_t i = graph_next_node(g_a, 0); i < g_a->n_nodes;
+		i = graph_next_node(g_a, i + 1))
+	{
+		for (graph_id_t j = graph_next_node(g_b, 0); j < g_b->n_nodes;
+			j = graph_next_node(g_b, j + 1))
+		{
+			sprintf(name_buf, "(%s,%s)", pa->names_a[i],
+				pa->names_b[j]);
 
-			for (int k = 0; k < g_b->nodes[j].n_adj; k++) {
-				if (g_b->nodes[g_b->nodes[j].adj[k].n].type != NODE_NODE) continue;
+			for (graph_id_t k = 0; k < g_b->nodes[j].n_adj; k++) {
+				if (g_b->types[g_b->nodes[j].adj[k].n] != NODE_NODE) continue;
 
 				sprintf(name_buf_neigh, "(%s,%s)",
-					g_a->nodes[i].name,
-					g_b->nodes[g_b->nodes[j].adj[k].n].name);
+					pa->names_a[i],
+					pa->names_b[g_b->nodes[j].adj[k].n]);
 
 				if ((res = graph_add_edge_name(g_prod, name_buf,
 					name_buf_neigh,
-					g_b->nodes[j].adj[k].attributes)))
+					prod_attr_b(pa, g_b->nodes[j].adj[k].attr))))
 				{
 					if (res == TOP_E_CONN) {
 						return_error(e_text, e_size, TOP_E_CONN,
@@ -629,6 +754,7 @@ graphs_root_product (graph_t *g_a, graph_t *g_b, graph_t *g_prod,
 		}
 	}
 
+	prod_attrs_free(pa);
 	free(name_buf);
 	free(name_buf_neigh);
 	return 0;
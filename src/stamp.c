@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "defs.h"
+#include "stamp.h"
+#include "graph.h"
+#include "name_trie.h"
+#include "errors.h"
+
+/* An instance of a module is a function of the values it reads from the
+ * bindings outside of it: the parameters of the submodule, index and
+ * whatever the enclosing modules bound.  The expansion of an instance
+ * records these reads, and its nodes and edges are kept as a stamp of the
+ * module.  Another instance that finds the same values in the same slots
+ * is then stamped into the graph under its own name instead of being
+ * expanded.  Modules with all-match connections or replacements, or with
+ * submodules that have them, are always expanded: those look at the
+ * names of the whole graph. */
+
+stamp_cache_t *
+stamp_cache_create (graph_t *g, network_definition_t *net)
+{
+	stamp_cache_t *sc = (stamp_cache_t *) calloc(1, sizeof(stamp_cache_t));
+	if (!sc)
+		return NULL;
+	sc->g = g;
+	sc->net = net;
+	sc->stamps = (stamp_t **) calloc(net->n_modules + 1, sizeof(stamp_t *));
+	sc->state = (unsigned char *) calloc(net->n_modules + 1, 1);
+	sc->n_stamps = (int *) calloc(net->n_modules + 1, sizeof(int));
+	if (!sc->stamps || !sc->state || !sc->n_stamps) {
+		stamp_cache_destroy(sc);
+		return NULL;
+	}
+	return sc;
+}
+
+static module_t *
+stamp_find_module (stamp_cache_t *sc, char *name)
+{
+	for (int i = 0; i < sc->net->n_modules; i++) {
+		if (strcmp(sc->net->modules[i].name, name) == 0)
+			return &sc->net->modules[i];
+	}
+	return NULL;
+}
+
+static bool
+stamp_conn_allowed (connection_wrapper_t *c)
+{
+	if (!c)
+		return true;
+	switch (c->type) {
+	case CONN_HAS_ALL:
+		return false;
+	case CONN_HAS_LOOP:
+		return stamp_conn_allowed(c->ptr.loop->conn);
+	case CONN_HAS_COND:
+		return stamp_conn_allowed(c->ptr.cond->conn_then) &&
+			stamp_conn_allowed(c->ptr.cond->conn_else);
+	default:
+		return true;
+	}
+}
+
+static bool
+stamp_subm_allowed (stamp_cache_t *sc, submodule_wrapper_t *smodule)
+{
+	if (!smodule)
+		return true;
+	if (smodule->type == SUBM_HAS_PROD) {
+		return stamp_subm_allowed(sc, smodule->ptr.prod->a) &&
+			stamp_subm_allowed(sc, smodule->ptr.prod->b);
+	} else if (smodule->type == SUBM_HAS_SUBM) {
+		/* a missing module is left for the expansion to report */
+		module_t *module = stamp_find_module(sc,
+			smodule->ptr.subm->module);
+		return module && stamp_allowed(sc, module);
+	} else {
+		return stamp_subm_allowed(sc, smodule->ptr.cond->subm_then) &&
+			stamp_subm_allowed(sc, smodule->ptr.cond->subm_else);
+	}
+}
+
+/* tells if the instances of module may be stamped; a module that is being
+ * checked counts as allowed, its other submodules decide */
+bool
+stamp_allowed (stamp_cache_t *sc, module_t *module)
+{
+	int k = module - sc->net->modules;
+	if (sc->state[k] != STAMP_UNKNOWN)
+		return sc->state[k] != STAMP_NO;
+	sc->state[k] = STAMP_VISITING;
+	bool allowed = (module->n_replace == 0);
+	for (int i = 0; allowed && (i < module->n_connections); i++)
+		allowed = stamp_conn_allowed(&module->connections[i]);
+	for (int i = 0; allowed && (i < module->n_submodules); i++)
+		allowed = stamp_subm_allowed(sc, &module->submodules[i]);
+	sc->state[k] = allowed ? STAMP_YES : STAMP_NO;
+	return allowed;
+}
+
+/* returns a stamp of module whose reads give the values bound now */
+stamp_t *
+stamp_find (stamp_cache_t *sc, module_t *module, param_stack_t *p)
+{
+	expr_cache_t *c = p->exprs;
+	stamp_t *st = sc->stamps[module - sc->net->modules];
+	for (; st; st = st->next) {
+		int i;
+		for (i = 0; i < st->n_reads; i++) {
+			int slot = st->reads[i].slot;
+			if ((c->scope[slot] < 0) ||
+				(c->values[slot] != st->reads[i].value))
+			{
+				break;
+			}
+		}
+		if (i == st->n_reads)
+			return st;
+	}
+	return NULL;
+}
+
+static void
+stamp_free (stamp_t *st)
+{
+	free(st->reads);
+	free(st->names);
+	free(st->types);
+	free(st->attrs);
+	free(st->adj_start);
+	free(st->adj);
+	free(st->adj_attrs);
+	free(st);
+}
+
+/* Makes a stamp of module from the nodes from n0 on, which an instance
+ * named prefix has just added, taking over reads.  The instance is not
+ * stamped if a node is not named under prefix or an edge leaves it. */
+int
+stamp_add (stamp_cache_t *sc, module_t *module, param_read_t *reads,
+	int n_reads, graph_id_t n0, char *prefix)
+{
+	graph_t *g = sc->g;
+	name_entry_t *entries = g->names->entries;
+	int k = module - sc->net->modules;
+	graph_id_t root = name_trie_find(g->names, prefix);
+	if ((sc->n_stamps[k] == STAMP_MAX) || (root < 0)) {
+		free(reads);
+		return 0;
+	}
+
+	graph_id_t n_adj = 0;
+	for (graph_id_t i = n0; i < g->n_nodes; i++) {
+		graph_id_t e = g->name_ids[i];
+		while ((e != root) && (e != NAME_TRIE_ROOT))
+			e = entries[e].parent;
+		if (e != root) {
+			free(reads);
+			return 0;
+		}
+		for (graph_id_t j = 0; j < g->nodes[i].n_adj; j++) {
+			if (g->nodes[i].adj[j].n < n0) {
+				free(reads);
+				return 0;
+			}
+		}
+		n_adj += g->nodes[i].n_adj;
+	}
+
+	stamp_t *st = (stamp_t *) calloc(1, sizeof(stamp_t));
+	if (!st) {
+		free(reads);
+		return TOP_E_ALLOC;
+	}
+	st->module = module;
+	st->reads = reads;
+	st->n_reads = n_reads;
+	st->prefix = root;
+	st->n_nodes = g->n_nodes - n0;
+	st->names = (graph_id_t *) malloc((st->n_nodes + 1) *
+		sizeof(graph_id_t));
+	st->types = (unsigned char *) malloc(st->n_nodes + 1);
+	st->attrs = (int *) malloc((st->n_nodes + 1) * sizeof(int));
+	st->adj_start = (graph_id_t *) malloc((st->n_nodes + 1) *
+		sizeof(graph_id_t));
+	st->adj = (graph_id_t *) malloc((n_adj + 1) * sizeof(graph_id_t));
+	st->adj_attrs = (int *) malloc((n_adj + 1) * sizeof(int));
+	if (!st->names || !st->types || !st->attrs || !st->adj_start ||
+		!st->adj || !st->adj_attrs)
+	{
+		stamp_free(st);
+		return TOP_E_ALLOC;
+	}
+	n_adj = 0;
+	for (graph_id_t i = 0; i < st->n_nodes; i++) {
+		node_t *node = &g->nodes[n0 + i];
+		st->names[i] = g->name_ids[n0 + i];
+		st->types[i] = g->types[n0 + i];
+		st->attrs[i] = node->attr;
+		st->adj_start[i] = n_adj;
+		for (graph_id_t j = 0; j < node->n_adj; j++) {
+			st->adj[n_adj] = node->adj[j].n - n0;
+			st->adj_attrs[n_adj] = node->adj[j].attr;
+			n_adj++;
+		}
+	}
+	st->adj_start[st->n_nodes] = n_adj;
+	st->next = sc->stamps[k];
+	sc->stamps[k] = st;
+	sc->n_stamps[k]++;
+	return 0;
+}
+
+/* the name e under the prefix from, moved under the prefix to */
+static graph_id_t
+stamp_name (name_trie_t *t, graph_id_t e, graph_id_t from, graph_id_t to)
+{
+	if (e == from)
+		return to;
+	graph_id_t parent = stamp_name(t, t->entries[e].parent, from, to);
+	if (parent < 0)
+		return -1;
+	return name_trie_child_id(t, parent, t->entries[e].comp, true);
+}
+
+/* Adds the nodes and edges of st to the graph, named under prefix.  If a
+ * node of that name is there already, the expansion would have connected
+ * to it or, if it is replaced, named its gates past it, so nothing is
+ * added and *r_applied is left false. */
+int
+stamp_apply (stamp_cache_t *sc, stamp_t *st, char *prefix, bool *r_applied)
+{
+	int res;
+	graph_t *g = sc->g;
+	graph_id_t base = g->n_nodes;
+	*r_applied = false;
+	graph_id_t root = name_trie_add(g->names, prefix);
+	if (root < 0)
+		return TOP_E_ALLOC;
+	graph_id_t *names = (graph_id_t *) malloc((st->n_nodes + 1) *
+		sizeof(graph_id_t));
+	if (!names)
+		return TOP_E_ALLOC;
+	for (graph_id_t i = 0; i < st->n_nodes; i++) {
+		names[i] = stamp_name(g->names, st->names[i], st->prefix, root);
+		if (names[i] < 0) {
+			free(names);
+			return TOP_E_ALLOC;
+		}
+		if (graph_name_used(g, names[i])) {
+			free(names);
+			return 0;
+		}
+	}
+	for (graph_id_t i = 0; i < st->n_nodes; i++) {
+		if ((res = graph_add_node_id(g, names[i], st->types[i],
+			st->attrs[i])))
+		{
+			free(names);
+			return res;
+		}
+	}
+	free(names);
+	for (graph_id_t i = 0; i < st->n_nodes; i++) {
+		node_t *node = &g->nodes[base + i];
+		for (graph_id_t j = st->adj_start[i]; j < st->adj_start[i + 1];
+			j++)
+		{
+			if ((res = graph_adj_push(g, node, base + st->adj[j],
+				st->adj_attrs[j])))
+			{
+				return res;
+			}
+		}
+	}
+	*r_applied = true;
+	return 0;
+}
+
+void
+stamp_cache_destroy (stamp_cache_t *sc)
+{
+	if (!sc)
+		return;
+	if (sc->stamps) {
+		for (int k = 0; k < sc->net->n_modules; k++) {
+			while (sc->stamps[k]) {
+				stamp_t *st = sc->stamps[k];
+				sc->stamps[k] = st->next;
+				stamp_free(st);
+			}
+		}
+	}
+	free(sc->stamps);
+	free(sc->state);
+	free(sc->n_stamps);
+	free(sc);
+}
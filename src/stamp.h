@@ -0,0 +1,25 @@
+#ifndef STAMP_H
+# define STAMP_H
+
+#include "defs.h"
+
+stamp_cache_t *
+stamp_cache_create (graph_t *g, network_definition_t *net);
+
+bool
+stamp_allowed (stamp_cache_t *sc, module_t *module);
+
+stamp_t *
+stamp_find (stamp_cache_t *sc, module_t *module, param_stack_t *p);
+
+int
+stamp_add (stamp_cache_t *sc, module_t *module, param_read_t *reads,
+	int n_reads, graph_id_t n0, char *prefix);
+
+int
+stamp_apply (stamp_cache_t *sc, stamp_t *st, char *prefix, bool *r_applied);
+
+void
+stamp_cache_destroy (stamp_cache_t *sc);
+
+#endif
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "defs.h"
+#include "str_pool.h"
+#include "arena.h"
+
+unsigned
+str_hash (const char *s)
+{
+	/* FNV-1a */
+	unsigned h = 2166136261u;
+	for (; *s; s++) {
+		h ^= (unsigned char) *s;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+str_pool_t *
+str_pool_create (void)
+{
+	str_pool_t *p = (str_pool_t *) calloc(1, sizeof(str_pool_t));
+	if (!p) return NULL;
+	p->cap_strs = STR_POOL_BLK_SIZE;
+	p->strs = (char **) malloc(p->cap_strs * sizeof(char *));
+	p->cap_index = 2 * STR_POOL_BLK_SIZE;
+	p->index = (graph_id_t *) malloc(p->cap_index * sizeof(graph_id_t));
+	p->mem = arena_create();
+	if (!p->strs || !p->index || !p->mem) {
+		arena_destroy(p->mem);
+		free(p->strs);
+		free(p->index);
+		free(p);
+		return NULL;
+	}
+	memset(p->index, -1, p->cap_index * sizeof(graph_id_t));
+	return p;
+}
+
+static int
+str_pool_grow (str_pool_t *p, graph_id_t cap_index)
+{
+	graph_id_t *index = (graph_id_t *) malloc(cap_index *
+		sizeof(graph_id_t));
+	if (!index) return -1;
+	memset(index, -1, cap_index * sizeof(graph_id_t));
+	for (graph_id_t i = 0; i < p->n_strs; i++) {
+		size_t k = str_hash(p->strs[i]) & (cap_index - 1);
+		while (index[k] >= 0)
+			k = (k + 1) & (cap_index - 1);
+		index[k] = i;
+	}
+	free(p->index);
+	p->index = index;
+	p->cap_index = cap_index;
+	return 0;
+}
+
+/* returns the id of the string equal to s, or -1 if there is none */
+graph_id_t
+str_pool_find (str_pool_t *p, const char *s)
+{
+	size_t k = str_hash(s) & (p->cap_index - 1);
+	for (; p->index[k] >= 0; k = (k + 1) & (p->cap_index - 1)) {
+		char *t = p->strs[p->index[k]];
+		if ((t == s) || (strcmp(t, s) == 0))
+			return p->index[k];
+	}
+	return -1;
+}
+
+/* interns s and returns its id, p->strs[id] stays valid until the pool is
+ * destroyed; returns -1 if out of memory */
+graph_id_t
+str_pool_add (str_pool_t *p, const char *s)
+{
+	if (2 * (p->n_strs + 1) > p->cap_index) {
+		if (str_pool_grow(p, 2 * p->cap_index))
+			return -1;
+	}
+	size_t k = str_hash(s) & (p->cap_index - 1);
+	for (; p->index[k] >= 0; k = (k + 1) & (p->cap_index - 1)) {
+		char *t = p->strs[p->index[k]];
+		if ((t == s) || (strcmp(t, s) == 0))
+			return p->index[k];
+	}
+	if (p->n_strs == p->cap_strs) {
+		char **strs = (char **) realloc(p->strs,
+			2 * p->cap_strs * sizeof(char *));
+		if (!strs) return -1;
+		p->strs = strs;
+		p->cap_strs *= 2;
+	}
+	size_t len = strlen(s) + 1;
+	char *t = arena_bump(p->mem, len);
+	if (!t) return -1;
+	memcpy(t, s, len);
+	p->strs[p->n_strs] = t;
+	p->index[k] = p->n_strs;
+	p->n_strs++;
+	return p->n_strs - 1;
+}
+
+void
+str_pool_destroy (str_pool_t *p)
+{
+	if (!p) return;
+	arena_destroy(p->mem);
+	free(p->strs);
+	free(p->index);
+	free(p);
+}
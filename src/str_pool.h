@@ -0,0 +1,21 @@
+#ifndef STR_POOL_H
+# define STR_POOL_H
+
+#include "defs.h"
+
+unsigned
+str_hash (const char *s);
+
+str_pool_t *
+str_pool_create (void);
+
+graph_id_t
+str_pool_add (str_pool_t *p, const char *s);
+
+graph_id_t
+str_pool_find (str_pool_t *p, const char *s);
+
+void
+str_pool_destroy (str_pool_t *p);
+
+#endif
@@ -7,7 +7,6 @@
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
-#include <regex.h>
 #include <limits.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -20,6 +19,12 @@
 #include "graph.h"
 #include "topologies.h"
 #include "products.h"
+#include "str_pool.h"
+#include "name_trie.h"
+#include "expr_cache.h"
+#include "expr_vm.h"
+#include "stamp.h"
+#include "name_match.h"
 #include "errors.h"
 
 static int
@@ -54,130 +59,368 @@ file_close (char *addr, size_t len)
 	munmap(addr, len);
 }
 
+/* adds a gate named <node>._auto[j] with the first free j and connects it
+ * to the node, *r_n_node is replaced by the gate; the search starts past
+ * the gates the node is known to have */
 static int
-add_auto_gate (graph_t *g, int *r_n_node, char *node_name, name_stack_t *s)
+add_auto_gate (graph_t *g, graph_id_t *r_n_node)
 {
 	int res;
 	int j;
-	int n_node = *r_n_node;
-	if ((res = name_stack_enter(s, node_name, -1))) return res;
+	graph_id_t n_node = *r_n_node;
+	graph_id_t parent = g->name_ids[n_node];
+	graph_id_t name;
 
-	char *auto_name = malloc(18); /* "_auto[2147483647]" */
-	for (j = 0; j < INT_MAX; j++) {
+	char auto_name[19]; /* "_auto[-2147483648]" */
+	for (j = g->nodes[n_node].n_auto; j < INT_MAX; j++) {
 		sprintf(auto_name, "_auto[%d]", j);
-		bool seen = false;
-		char *full_name = get_full_name(s, auto_name, -1);
-		for (int k = 0; k < g->n_nodes; k++) {
-			if (strcmp(g->nodes[k].name, full_name) == 0)
-			{
-				seen = true;
-			}
-		}
-		free(full_name);
-		if (!seen) break;
+		name = name_trie_child(g->names, parent, auto_name, false);
+		if ((name < 0) || !graph_name_used(g, name))
+			break;
 	}
-	char *full_name = get_full_name(s, auto_name, -1);
-	if ((res = graph_add_node(g, full_name, NODE_GATE, NULL))) return res;
-	*r_n_node = graph_find_node(g, full_name);
-	graph_add_edge_id(g, n_node, *r_n_node, NULL);
-	free(full_name);
-	free(auto_name);
-	name_stack_leave(s);
+	g->nodes[n_node].n_auto = j + 1;
+	name = name_trie_child(g->names, parent, auto_name, true);
+	if (name < 0)
+		return TOP_E_ALLOC;
+	if ((res = graph_add_node_id(g, name, NODE_GATE, 0))) return res;
+	*r_n_node = g->n_nodes - 1;
+	graph_add_edge_id(g, n_node, *r_n_node, 0);
 	return 0;
 }
 
 static int
-add_auto_gate_full_name (graph_t *g, int *r_n_node, char *full_node_name)
+conn_error (graph_t *g, graph_id_t n_node_a, graph_id_t n_node_b,
+	char *e_text, size_t e_size)
 {
-	int res;
-	int j;
-	int n_node = *r_n_node;
-
-	char *auto_name = malloc(18); /* "_auto[2147483647]" */
-	for (j = 0; j < INT_MAX; j++) {
-		sprintf(auto_name, "_auto[%d]", j);
-		bool seen = false;
-		char *full_name = malloc(strlen(full_node_name) + 18);
-		sprintf(full_name, "%s.%s", full_node_name, auto_name);
-		for (int k = 0; k < g->n_nodes; k++) {
-			if (strcmp(g->nodes[k].name, full_name) == 0)
-			{
-				seen = true;
-			}
-		}
-		free(full_name);
-		if (!seen) break;
+	char *name_a = NULL, *name_b = NULL;
+	size_t cap_a = 0, cap_b = 0;
+	if (!graph_node_name(g, n_node_a, &name_a, &cap_a) ||
+		!graph_node_name(g, n_node_b, &name_b, &cap_b))
+	{
+		free(name_a);
+		free(name_b);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 	}
-	char *full_name = malloc(strlen(full_node_name) + 18);
-	sprintf(full_name, "%s.%s", full_node_name, auto_name);
-	if ((res = graph_add_node(g, full_name, NODE_GATE, NULL))) return res;
-	*r_n_node = graph_find_node(g, full_name);
-	graph_add_edge_id(g, n_node, *r_n_node, NULL);
-	free(full_name);
-	free(auto_name);
-	return 0;
+	return_error(e_text, e_size, TOP_E_CONN, " %s %s", name_a, name_b);
+	free(name_a);
+	free(name_b);
+	return TOP_E_CONN;
 }
 
+/* finds the endpoints of a plain connection */
 static int
-graph_eval_and_add_edge (graph_t *g, param_stack_t *p,
-	name_stack_t *s, connection_wrapper_t *conn,
+graph_eval_conn (graph_t *g, param_stack_t *p, name_stack_t *s,
+	connection_wrapper_t *conn, graph_id_t *r_n_a, graph_id_t *r_n_b,
 	char *e_text, size_t e_size)
 {
-	char *r_name_a = conn->ptr.conn->from;
-	char *r_name_b = conn->ptr.conn->to;
-	char *name_a, *name_b;
 	int res;
-	if ((res = eval_conn_name(p, r_name_a, &name_a, e_text, e_size)))
-		return res;
-	if ((res = eval_conn_name(p, r_name_b, &name_b, e_text, e_size))) {
-		free(name_a);
+	if ((res = name_tmpl_eval(p, conn->ptr.conn->from_tmpl, s,
+		&s->conn_a, e_text, e_size)))
+	{
 		return res;
 	}
-	char *full_name_a = get_full_name(s, name_a, -1);
-	if (!full_name_a) {
-		free(name_a);
-		free(name_b);
-		return return_error(e_text, e_size, TOP_E_ALLOC, "");
-	}
-	char *full_name_b = get_full_name(s, name_b, -1);
-	if (!full_name_b) {
-		free(name_a);
-		free(name_b);
-		free(full_name_a);
-		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	if ((res = name_tmpl_eval(p, conn->ptr.conn->to_tmpl, s,
+		&s->conn_b, e_text, e_size)))
+	{
+		return res;
 	}
+	char *full_name_a = s->conn_a.buf;
+	char *full_name_b = s->conn_b.buf;
 
-	int n_node_a = graph_find_node(g, full_name_a);
-	int n_node_b = graph_find_node(g, full_name_b);
-	if (n_node_a < 0)
+	*r_n_a = graph_find_node(g, full_name_a);
+	*r_n_b = graph_find_node(g, full_name_b);
+	if (*r_n_a < 0)
 		return return_error(e_text, e_size, TOP_E_CONN,
 			" %s %s", full_name_a, full_name_b);
-	if (n_node_b < 0)
+	if (*r_n_b < 0)
 		return return_error(e_text, e_size, TOP_E_CONN,
 			" %s %s", full_name_a, full_name_b);
-	if (g->nodes[n_node_a].type == NODE_NODE)
-		if (add_auto_gate(g, &n_node_a, name_a, s))
+	return 0;
+}
+
+/* connects n_node_a and n_node_b, through new gates if they are nodes */
+static int
+graph_add_conn (graph_t *g, connection_wrapper_t *conn,
+	graph_id_t n_node_a, graph_id_t n_node_b, char *e_text, size_t e_size)
+{
+	graph_id_t n_a = n_node_a;
+	graph_id_t n_b = n_node_b;
+	if (g->types[n_a] == NODE_NODE)
+		if (add_auto_gate(g, &n_a))
 			return return_error(e_text, e_size, TOP_E_ALLOC, "");
-	if (g->nodes[n_node_b].type == NODE_NODE)
-		if (add_auto_gate(g, &n_node_b, name_b, s))
+	if (g->types[n_b] == NODE_NODE)
+		if (add_auto_gate(g, &n_b))
 			return return_error(e_text, e_size, TOP_E_ALLOC, "");
 
-	if (graph_add_edge_id(g, n_node_a, n_node_b, conn->ptr.conn->attributes)) {
-		return_error(e_text, e_size, TOP_E_CONN,
-			" %s %s", full_name_a, full_name_b);
-		free(name_a);
-		free(name_b);
-		free(full_name_a);
-		free(full_name_b);
-		return TOP_E_CONN;
+	int attr;
+	if (graph_attr_id(g, conn->ptr.conn->attributes, &attr))
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	if (graph_add_edge_id(g, n_a, n_b, attr))
+		return conn_error(g, n_node_a, n_node_b, e_text, e_size);
+	return 0;
+}
+
+static int
+graph_eval_and_add_edge (graph_t *g, param_stack_t *p,
+	name_stack_t *s, connection_wrapper_t *conn,
+	char *e_text, size_t e_size)
+{
+	int res;
+	graph_id_t n_node_a, n_node_b;
+	if ((res = graph_eval_conn(g, p, s, conn, &n_node_a, &n_node_b,
+		e_text, e_size)) ||
+		(res = graph_add_conn(g, conn, n_node_a, n_node_b,
+		e_text, e_size)))
+	{
+		return res;
+	}
+	return 0;
+}
+
+/* Sets up aff for the endpoint node that t gave in b at the first
+ * iteration of a loop over the variable in slot.  Fails if more than
+ * one index depends on the variable or one does in a way that is not
+ * affine over the whole range. */
+static bool
+conn_affine_init (graph_t *g, param_stack_t *p, name_tmpl_t *t,
+	name_buf_t *b, graph_id_t node, int slot, int start, int end,
+	conn_affine_t *aff)
+{
+	expr_cache_t *c = p->exprs;
+	expr_t *x = NULL;
+	int m = -1;
+	for (int i = 0; i < t->n_exprs; i++) {
+		expr_t *y;
+		if (expr_cache_get(c, t->exprs[i], &y) || y->n_shadows)
+			return false;
+		for (int k = 0; k < y->n_slots; k++) {
+			if (y->slots[k] != slot)
+				continue;
+			if (m >= 0)
+				return false;
+			m = i;
+			x = y;
+		}
+	}
+	aff->node = node;
+	aff->level = -1;
+	if (m < 0)
+		return true;
+
+	int64_t v0, v1;
+	if (!expr_vm_affine(x, c->values, slot, start, end - 1, &v0, &v1))
+		return false;
+	aff->first = v0;
+	aff->step = (v1 - v0) / (end - 1 - start);
+
+	/* the index in the name written for the first iteration, and the
+	 * component around it as the trie splits names */
+	char digits[24];
+	int n_digits = sprintf(digits, "%d", (int) v0);
+	size_t d = b->ends[m] - 1 - n_digits;
+	if (memcmp(b->buf + d, digits, n_digits))
+		return false;
+	size_t comp_start = 0, comp_end = 0;
+	int depth = 0, level = 0;
+	for (size_t i = 0; b->buf[i]; i++) {
+		if ((b->buf[i] == '(') || (b->buf[i] == '[')) {
+			depth++;
+		} else if ((b->buf[i] == ')') || (b->buf[i] == ']')) {
+			depth--;
+		} else if ((b->buf[i] == '.') && (depth == 0)) {
+			if (i < d)
+				comp_start = i + 1;
+			else if (level++ == 0)
+				comp_end = i;
+		}
+	}
+	if (level == 0)
+		comp_end = strlen(b->buf);
+
+	graph_id_t e = g->name_ids[node];
+	for (int l = 0; l < level; l++)
+		e = g->names->entries[e].parent;
+	aff->level = level;
+	aff->comp = g->names->comps->strs[g->names->entries[e].comp];
+	aff->comp_len = comp_end - comp_start;
+	aff->pre_len = d - comp_start;
+	aff->post_len = comp_end - d - n_digits;
+	return (strlen(aff->comp) == aff->comp_len) &&
+		!memcmp(aff->comp, b->buf + comp_start, aff->comp_len);
+}
+
+/* checks that n is the endpoint aff gives at iteration k, which is the
+ * case if its name is the one of aff->node with the index replaced */
+static bool
+conn_affine_check (graph_t *g, conn_affine_t *aff, graph_id_t n, int k)
+{
+	if (aff->level < 0)
+		return n == aff->node;
+	if ((n < 0) || (n >= g->n_nodes) ||
+		(graph_find_node_id(g, g->name_ids[n]) != n))
+	{
+		return false;
+	}
+	name_entry_t *entries = g->names->entries;
+	graph_id_t e = g->name_ids[n];
+	graph_id_t e0 = g->name_ids[aff->node];
+	for (int l = 0; l < aff->level; l++) {
+		if ((e == NAME_TRIE_ROOT) || (entries[e].comp != entries[e0].comp))
+			return false;
+		e = entries[e].parent;
+		e0 = entries[e0].parent;
+	}
+	if ((e == NAME_TRIE_ROOT) || (entries[e].parent != entries[e0].parent))
+		return false;
+
+	const char *comp = g->names->comps->strs[entries[e].comp];
+	char digits[24];
+	int n_digits = sprintf(digits, "%d", (int) (aff->first + k * aff->step));
+	return (strlen(comp) == aff->pre_len + n_digits + aff->post_len) &&
+		!memcmp(comp, aff->comp, aff->pre_len) &&
+		!memcmp(comp + aff->pre_len, digits, n_digits) &&
+		!memcmp(comp + aff->pre_len + n_digits,
+		aff->comp + aff->comp_len - aff->post_len, aff->post_len);
+}
+
+/* the guess of aff for iteration k, or -1 if it is out of range */
+static graph_id_t
+conn_affine_guess (conn_affine_t *aff, int k)
+{
+	graph_id_t n;
+	if (__builtin_mul_overflow((graph_id_t) k, aff->stride, &n) ||
+		__builtin_add_overflow(n, aff->node, &n) || (n < 0))
+	{
+		return -1;
+	}
+	return n;
+}
+
+/* adds the edges of iterations k0 .. k1 - 1 of an affine loop, whose
+ * guesses have all been checked, in one loop */
+static int
+graph_add_conns_strided (graph_t *g, connection_wrapper_t *conn,
+	conn_affine_t *aff_a, conn_affine_t *aff_b, int k0, int k1,
+	char *e_text, size_t e_size)
+{
+	int attr;
+	if (graph_attr_id(g, conn->ptr.conn->attributes, &attr))
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	for (int k = k0; k < k1; k++) {
+		graph_id_t n_node_a = conn_affine_guess(aff_a, k);
+		graph_id_t n_node_b = conn_affine_guess(aff_b, k);
+		graph_id_t n_a = n_node_a;
+		graph_id_t n_b = n_node_b;
+		if ((g->types[n_a] == NODE_NODE) && add_auto_gate(g, &n_a))
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		if ((g->types[n_b] == NODE_NODE) && add_auto_gate(g, &n_b))
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		if (graph_add_edge_id(g, n_a, n_b, attr))
+			return conn_error(g, n_node_a, n_node_b, e_text, e_size);
 	}
-	free(name_a);
-	free(name_b);
-	free(full_name_a);
-	free(full_name_b);
 	return 0;
 }
 
+/* A loop around a single connection whose endpoints are members of
+ * submodule arrays, like s[a*i+b] and t[c*i+d], usually finds them at ids
+ * that grow by a fixed stride: the members were expanded one after the
+ * other.  The first two iterations run as usual and give the strides;
+ * the endpoints of the other iterations are guessed without binding the
+ * loop variable or writing names, and the guesses are checked against the
+ * name trie.  The checks do not depend on the edges added, so they are
+ * made for the whole range first and the edges up to the first miss are
+ * emitted in one loop.  From there on an iteration whose guess fails runs
+ * as usual. */
+static int
+traverse_affine_loop (connection_wrapper_t *c, graph_t *g,
+	param_stack_t *p, name_stack_t *s, int start, int end,
+	char *e_text, size_t e_size)
+{
+	int res;
+	connection_wrapper_t *conn = c->ptr.loop->conn;
+	char *var = c->ptr.loop->loop;
+	int slot = str_pool_find(p->exprs->names, var);
+	conn_affine_t aff_a, aff_b;
+	graph_id_t n_a[2], n_b[2];
+	bool affine = false;
+	int mark = p->n;
+
+	for (int k = 0; k < 2; k++) {
+		if (param_stack_enter_val(p, var, start + k)) {
+			res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+			goto out;
+		}
+		if ((res = graph_eval_conn(g, p, s, conn, &n_a[k], &n_b[k],
+			e_text, e_size)))
+		{
+			goto out;
+		}
+		if (k == 0) {
+			affine = (slot >= 0) &&
+				conn_affine_init(g, p, conn->ptr.conn->from_tmpl,
+				&s->conn_a, n_a[0], slot, start, end, &aff_a) &&
+				conn_affine_init(g, p, conn->ptr.conn->to_tmpl,
+				&s->conn_b, n_b[0], slot, start, end, &aff_b);
+		}
+		if ((res = graph_add_conn(g, conn, n_a[k], n_b[k], e_text,
+			e_size)))
+		{
+			goto out;
+		}
+		param_stack_leave(p);
+	}
+
+	int k_bulk = 2;
+	if (affine) {
+		aff_a.stride = n_a[1] - n_a[0];
+		aff_b.stride = n_b[1] - n_b[0];
+		while ((k_bulk < end - start) &&
+			conn_affine_check(g, &aff_a,
+			conn_affine_guess(&aff_a, k_bulk), k_bulk) &&
+			conn_affine_check(g, &aff_b,
+			conn_affine_guess(&aff_b, k_bulk), k_bulk))
+		{
+			k_bulk++;
+		}
+		if ((res = graph_add_conns_strided(g, conn, &aff_a, &aff_b, 2,
+			k_bulk, e_text, e_size)))
+		{
+			goto out;
+		}
+	}
+
+	for (int j = start + k_bulk; j < end; j++) {
+		int k = j - start;
+		graph_id_t n_node_a = affine ? conn_affine_guess(&aff_a, k) : -1;
+		graph_id_t n_node_b = affine ? conn_affine_guess(&aff_b, k) : -1;
+		if (!affine || !conn_affine_check(g, &aff_a, n_node_a, k) ||
+			!conn_affine_check(g, &aff_b, n_node_b, k))
+		{
+			if (param_stack_enter_val(p, var, j)) {
+				res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+				goto out;
+			}
+			if ((res = graph_eval_conn(g, p, s, conn, &n_node_a,
+				&n_node_b, e_text, e_size)))
+			{
+				goto out;
+			}
+			param_stack_leave(p);
+		}
+		if ((res = graph_add_conn(g, conn, n_node_a, n_node_b, e_text,
+			e_size)))
+		{
+			goto out;
+		}
+	}
+	res = 0;
+out:
+	/* an error leaves the loop variable bound */
+	while (p->n > mark)
+		param_stack_leave(p);
+	return res;
+}
+
 static module_t *
 find_module (network_definition_t *net, char *name)
 {
@@ -190,28 +433,23 @@ find_module (network_definition_t *net, char *name)
 
 static int
 add_gate (graph_t *g, name_stack_t *s, char *name_s,
-	gate_t *gate, int j, char *e_text, size_t e_size)
+	gate_t *gate, int j, char **full_name, size_t *full_name_cap,
+	char *e_text, size_t e_size)
 {
 	int res;
-	char *full_name = get_full_name(s, gate->name, j);
-	if (!full_name)
+	if (!get_full_name(s, gate->name, j, full_name, full_name_cap))
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
-	if (graph_add_node(g, full_name, NODE_GATE, NULL)) {
-		free(full_name);
+	if (graph_add_node(g, *full_name, NODE_GATE, 0))
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
-	}
-	if ((res = graph_add_edge_name(g, full_name, name_s, NULL))) {
+	if ((res = graph_add_edge_name(g, *full_name, name_s, 0))) {
 		if (res == TOP_E_CONN) {
 			return_error(e_text, e_size, TOP_E_CONN,
-				" %s %s", full_name, name_s);
-			free(full_name);
+				" %s %s", *full_name, name_s);
 			return TOP_E_CONN;
 		} else {
-			free(full_name);
 			return return_error(e_text, e_size, res, "");
 		}
 	}
-	free(full_name);
 	return 0;
 }
 
@@ -219,6 +457,44 @@ static int
 expand_module (graph_t *g, module_t *module, network_definition_t *net,
 	name_stack_t *s, param_stack_t *p, char *e_text, size_t e_size);
 
+/* expands an instance of module that may be stamped: from a stamp if
+ * one fits, otherwise as usual, making a stamp of it */
+static int
+expand_stamped (graph_t *g, module_t *module, network_definition_t *net,
+	name_stack_t *s, param_stack_t *p, char *e_text, size_t e_size)
+{
+	int res;
+	stamp_cache_t *sc = p->stamps;
+	char *name = name_stack_name(s);
+	stamp_t *st = stamp_find(sc, module, p);
+	if (st) {
+		bool applied;
+		if ((res = stamp_apply(sc, st, name, &applied)))
+			return return_error(e_text, e_size, res, "");
+		if (applied) {
+			if (param_stack_rec_reads(p, st->reads, st->n_reads))
+				return return_error(e_text, e_size,
+					TOP_E_ALLOC, "");
+			return 0;
+		}
+	}
+
+	graph_id_t n0 = g->n_nodes;
+	param_read_t *reads;
+	int n_reads;
+	if (param_stack_rec_begin(p))
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	res = expand_module(g, module, net, s, p, e_text, e_size);
+	param_stack_rec_end(p, &reads, &n_reads);
+	if (res || st) {
+		free(reads);
+		return res;
+	}
+	if (stamp_add(sc, module, reads, n_reads, n0, name))
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	return 0;
+}
+
 static int
 enter_and_expand_module (network_definition_t *net, graph_t *g,
 	name_stack_t *s, param_stack_t *p,
@@ -234,12 +510,16 @@ enter_and_expand_module (network_definition_t *net, graph_t *g,
 		return return_error(e_text, e_size, TOP_E_NOMOD,
 			": %s", smodule->module);
 	}
-	if ((res = expand_module(g, module, net, s, p, e_text, e_size))) {
-		name_stack_leave(s);
-		return res;
+	if (p->stamps && (p->stamps->g == g) &&
+		(module->type == MODULE_COMPOUND) &&
+		stamp_allowed(p->stamps, module))
+	{
+		res = expand_stamped(g, module, net, s, p, e_text, e_size);
+	} else {
+		res = expand_module(g, module, net, s, p, e_text, e_size);
 	}
 	name_stack_leave(s);
-	return 0;
+	return res;
 }
 
 static int
@@ -247,6 +527,9 @@ traverse_and_add_conns (connection_wrapper_t *c, graph_t *g,
 	param_stack_t *p, name_stack_t *s, char *e_text, size_t e_size)
 {
 	int res;
+	graph_id_t *nodes_to_connect = NULL;
+	name_buf_t full_name = { 0 };
+	int mark = p->n;
 	if (c->type == CONN_HAS_LOOP) {
 		double tmp_d;
 		if ((res = param_stack_eval(p, c->ptr.loop->start, &tmp_d,
@@ -265,13 +548,21 @@ traverse_and_add_conns (connection_wrapper_t *c, graph_t *g,
 			return return_error(e_text, e_size, TOP_E_LOOP,
 				"%d > %d\n", start, end);
 		}
+		if ((c->ptr.loop->conn->type == CONN_HAS_CONN) &&
+			(end - start >= CONN_AFFINE_MIN))
+		{
+			return traverse_affine_loop(c, g, p, s, start, end,
+				e_text, e_size);
+		}
 		for (int j = start; j < end; j++) {
-			if (param_stack_enter_val(p, c->ptr.loop->loop, j))
-				return return_error(e_text, e_size, TOP_E_ALLOC, "");
+			if (param_stack_enter_val(p, c->ptr.loop->loop, j)) {
+				res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+				goto out;
+			}
 			if ((res = traverse_and_add_conns(c->ptr.loop->conn, g,
 				p, s, e_text, e_size)))
 			{
-				return res;
+				goto out;
 			}
 			param_stack_leave(p);
 		}
@@ -280,193 +571,227 @@ traverse_and_add_conns (connection_wrapper_t *c, graph_t *g,
 		if ((res = param_stack_eval(p, c->ptr.alllist->start, &tmp_d,
 			e_text, e_size)))
 		{
-			return res;
+			goto out;
 		}
 		int start = lrint(tmp_d);
 		if ((res = param_stack_eval(p, c->ptr.alllist->end, &tmp_d,
 			e_text, e_size)))
 		{
-			return res;
+			goto out;
 		}
 		int end = lrint(tmp_d);
 		if (start > end) {
-			return return_error(e_text, e_size, TOP_E_LOOP,
+			res = return_error(e_text, e_size, TOP_E_LOOP,
 				"%d > %d\n", start, end);
+			goto out;
+		}
+		int attr;
+		if (graph_attr_id(g, c->ptr.alllist->attributes, &attr)) {
+			res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+			goto out;
+		}
+		nodes_to_connect = malloc((end - start) *
+			sizeof(graph_id_t));
+		if (!nodes_to_connect) {
+			res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+			goto out;
 		}
-		char *n_name;
-		int res;
-		int *nodes_to_connect = malloc((end - start) * sizeof(int));
 		for (int j = start; j < end; j++) {
-			if (param_stack_enter_val(p, c->ptr.alllist->var, j))
-				return return_error(e_text, e_size, TOP_E_ALLOC, "");
-			if ((res = eval_conn_name(p, c->ptr.alllist->nodes, &n_name, e_text, e_size)))
-				return res;
-			char *full_name = get_full_name(s, n_name, -1);
-			nodes_to_connect[j - start] = graph_find_node(g, full_name);
-			if (nodes_to_connect[j - start] < 0)
-				return return_error(e_text, e_size, TOP_E_NODE, " %s", full_name);
-			free(n_name);
-			free(full_name);
+			if (param_stack_enter_val(p, c->ptr.alllist->var, j)) {
+				res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+				goto out;
+			}
+			if ((res = name_tmpl_eval(p, c->ptr.alllist->nodes_tmpl, s,
+				&full_name, e_text, e_size)))
+			{
+				goto out;
+			}
+			nodes_to_connect[j - start] = graph_find_node(g,
+				full_name.buf);
+			if (nodes_to_connect[j - start] < 0) {
+				res = return_error(e_text, e_size, TOP_E_NODE, " %s",
+					full_name.buf);
+				goto out;
+			}
 			param_stack_leave(p);
 		}
-		int n_node_a, n_node_b;
+		graph_id_t n_node_a, n_node_b;
 		for (int i = 1; i < end - start; i++) {
 			for (int j = 0; j < i; j++) {
 				n_node_a = nodes_to_connect[i];
 				n_node_b = nodes_to_connect[j];
-				if (add_auto_gate_full_name(g, &n_node_a,
-					g->nodes[nodes_to_connect[i]].name))
-				{
-					return return_error(e_text, e_size, TOP_E_ALLOC, "");
+				if (add_auto_gate(g, &n_node_a)) {
+					res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+					goto out;
 				}
-				if (add_auto_gate_full_name(g, &n_node_b,
-					g->nodes[nodes_to_connect[j]].name))
-				{
-					return return_error(e_text, e_size, TOP_E_ALLOC, "");
+				if (add_auto_gate(g, &n_node_b)) {
+					res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+					goto out;
 				}
 				if (graph_add_edge_id(g, n_node_a, n_node_b,
-					c->ptr.alllist->attributes))
+					attr))
 				{
-					return return_error(e_text, e_size, TOP_E_CONN,
-						" %s %s", g->nodes[n_node_a].name,
-						g->nodes[n_node_b].name);
+					res = conn_error(g, n_node_a, n_node_b, e_text,
+						e_size);
+					goto out;
 				}
 			}
 		}
-		free(nodes_to_connect);
 	} else if (c->type == CONN_HAS_LINE) {
 		double tmp_d;
 		if ((res = param_stack_eval(p, c->ptr.line->start, &tmp_d,
 			e_text, e_size)))
 		{
-			return res;
+			goto out;
 		}
 		int start = lrint(tmp_d);
 		if ((res = param_stack_eval(p, c->ptr.line->end, &tmp_d,
 			e_text, e_size)))
 		{
-			return res;
+			goto out;
 		}
 		int end = lrint(tmp_d);
 		if (start > end) {
-			return return_error(e_text, e_size, TOP_E_LOOP,
+			res = return_error(e_text, e_size, TOP_E_LOOP,
 				"%d > %d\n", start, end);
+			goto out;
+		}
+		int attr;
+		if (graph_attr_id(g, c->ptr.line->attributes, &attr)) {
+			res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+			goto out;
+		}
+		nodes_to_connect = malloc((end - start) *
+			sizeof(graph_id_t));
+		if (!nodes_to_connect) {
+			res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+			goto out;
 		}
-		char *n_name;
-		int res;
-		int *nodes_to_connect = malloc((end - start) * sizeof(int));
 		for (int j = start; j < end; j++) {
-			if (param_stack_enter_val(p, c->ptr.line->var, j))
-				return return_error(e_text, e_size, TOP_E_ALLOC, "");
-			if ((res = eval_conn_name(p, c->ptr.line->nodes, &n_name, e_text, e_size)))
-				return res;
-			char *full_name = get_full_name(s, n_name, -1);
-			nodes_to_connect[j - start] = graph_find_node(g, full_name);
-			if (nodes_to_connect[j - start] < 0)
-				return return_error(e_text, e_size, TOP_E_NODE, " %s", full_name);
-			free(n_name);
-			free(full_name);
+			if (param_stack_enter_val(p, c->ptr.line->var, j)) {
+				res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+				goto out;
+			}
+			if ((res = name_tmpl_eval(p, c->ptr.line->nodes_tmpl, s,
+				&full_name, e_text, e_size)))
+			{
+				goto out;
+			}
+			nodes_to_connect[j - start] = graph_find_node(g,
+				full_name.buf);
+			if (nodes_to_connect[j - start] < 0) {
+				res = return_error(e_text, e_size, TOP_E_NODE, " %s",
+					full_name.buf);
+				goto out;
+			}
 			param_stack_leave(p);
 		}
-		int n_node_a, n_node_b;
+		graph_id_t n_node_a, n_node_b;
 		for (int i = 0; i < end - start - 1; i++) {
 			n_node_a = nodes_to_connect[i];
 			n_node_b = nodes_to_connect[i + 1];
-			if (add_auto_gate_full_name(g, &n_node_a,
-				g->nodes[nodes_to_connect[i]].name))
-			{
-				return return_error(e_text, e_size, TOP_E_ALLOC, "");
+			if (add_auto_gate(g, &n_node_a)) {
+				res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+				goto out;
 			}
-			if (add_auto_gate_full_name(g, &n_node_b,
-				g->nodes[nodes_to_connect[i + 1]].name))
-			{
-				return return_error(e_text, e_size, TOP_E_ALLOC, "");
+			if (add_auto_gate(g, &n_node_b)) {
+				res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+				goto out;
 			}
 			if (graph_add_edge_id(g, n_node_a, n_node_b,
-				c->ptr.line->attributes))
+				attr))
 			{
-				return return_error(e_text, e_size, TOP_E_CONN,
-					" %s %s", g->nodes[n_node_a].name,
-					g->nodes[n_node_b].name);
+				res = conn_error(g, n_node_a, n_node_b, e_text,
+					e_size);
+				goto out;
 			}
 		}
-		free(nodes_to_connect);
 	} else if (c->type == CONN_HAS_RING) {
 		double tmp_d;
 		if ((res = param_stack_eval(p, c->ptr.ring->start, &tmp_d,
 			e_text, e_size)))
 		{
-			return res;
+			goto out;
 		}
 		int start = lrint(tmp_d);
 		if ((res = param_stack_eval(p, c->ptr.ring->end, &tmp_d,
 			e_text, e_size)))
 		{
-			return res;
+			goto out;
 		}
 		int end = lrint(tmp_d);
 		if (start > end) {
-			return return_error(e_text, e_size, TOP_E_LOOP,
+			res = return_error(e_text, e_size, TOP_E_LOOP,
 				"%d > %d\n", start, end);
+			goto out;
+		}
+		int attr;
+		if (graph_attr_id(g, c->ptr.ring->attributes, &attr)) {
+			res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+			goto out;
+		}
+		nodes_to_connect = malloc((end - start) *
+			sizeof(graph_id_t));
+		if (!nodes_to_connect) {
+			res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+			goto out;
 		}
-		char *n_name;
-		int res;
-		int *nodes_to_connect = malloc((end - start) * sizeof(int));
 		for (int j = start; j < end; j++) {
-			if (param_stack_enter_val(p, c->ptr.ring->var, j))
-				return return_error(e_text, e_size, TOP_E_ALLOC, "");
-			if ((res = eval_conn_name(p, c->ptr.ring->nodes, &n_name, e_text, e_size)))
-				return res;
-			char *full_name = get_full_name(s, n_name, -1);
-			nodes_to_connect[j - start] = graph_find_node(g, full_name);
-			if (nodes_to_connect[j - start] < 0)
-				return return_error(e_text, e_size, TOP_E_NODE, " %s", full_name);
-			free(n_name);
-			free(full_name);
+			if (param_stack_enter_val(p, c->ptr.ring->var, j)) {
+				res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+				goto out;
+			}
+			if ((res = name_tmpl_eval(p, c->ptr.ring->nodes_tmpl, s,
+				&full_name, e_text, e_size)))
+			{
+				goto out;
+			}
+			nodes_to_connect[j - start] = graph_find_node(g,
+				full_name.buf);
+			if (nodes_to_connect[j - start] < 0) {
+				res = return_error(e_text, e_size, TOP_E_NODE, " %s",
+					full_name.buf);
+				goto out;
+			}
 			param_stack_leave(p);
 		}
-		int n_node_a, n_node_b;
+		graph_id_t n_node_a, n_node_b;
 		for (int i = 0; i < end - start - 1; i++) {
 			n_node_a = nodes_to_connect[i];
 			n_node_b = nodes_to_connect[i + 1];
-			if (add_auto_gate_full_name(g, &n_node_a,
-				g->nodes[nodes_to_connect[i]].name))
-			{
-				return return_error(e_text, e_size, TOP_E_ALLOC, "");
+			if (add_auto_gate(g, &n_node_a)) {
+				res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+				goto out;
 			}
-			if (add_auto_gate_full_name(g, &n_node_b,
-				g->nodes[nodes_to_connect[i + 1]].name))
-			{
-				return return_error(e_text, e_size, TOP_E_ALLOC, "");
+			if (add_auto_gate(g, &n_node_b)) {
+				res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+				goto out;
 			}
 			if (graph_add_edge_id(g, n_node_a, n_node_b,
-				c->ptr.ring->attributes))
+				attr))
 			{
-				return return_error(e_text, e_size, TOP_E_CONN,
-					" %s %s", g->nodes[n_node_a].name,
-					g->nodes[n_node_b].name);
+				res = conn_error(g, n_node_a, n_node_b, e_text,
+					e_size);
+				goto out;
 			}
 		}
 		n_node_a = nodes_to_connect[0];
 		n_node_b = nodes_to_connect[end - start - 1];
-		if (add_auto_gate_full_name(g, &n_node_a,
-			g->nodes[nodes_to_connect[0]].name))
-		{
-			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		if (add_auto_gate(g, &n_node_a)) {
+			res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+			goto out;
 		}
-		if (add_auto_gate_full_name(g, &n_node_b,
-			g->nodes[nodes_to_connect[end - start - 1]].name))
-		{
-			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		if (add_auto_gate(g, &n_node_b)) {
+			res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+			goto out;
 		}
 		if (graph_add_edge_id(g, n_node_a, n_node_b,
-			c->ptr.ring->attributes))
+			attr))
 		{
-			return return_error(e_text, e_size, TOP_E_CONN,
-				" %s %s", g->nodes[n_node_a].name,
-				g->nodes[n_node_b].name);
+			res = conn_error(g, n_node_a, n_node_b, e_text,
+				e_size);
+			goto out;
 		}
-		free(nodes_to_connect);
 	} else if (c->type == CONN_HAS_COND) {
 		double tmp_d;
 		if ((res = param_stack_eval(p, c->ptr.cond->condition, &tmp_d,
@@ -490,69 +815,60 @@ traverse_and_add_conns (connection_wrapper_t *c, graph_t *g,
 			}
 		}
 	} else if (c->type == CONN_HAS_ALL) {
-		regex_t regex;
-		int selected_n = 0;
-		int selected_blk = 32;
-		int selected_cap = selected_blk;
-		int *selected = malloc(selected_cap * sizeof(int));
-		if (!selected)
-			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		name_match_t match;
+		graph_id_t *selected;
+		graph_id_t selected_n;
 
-		if (regcomp(&regex, c->ptr.all->nodes, 0)) {
-			return return_error(e_text, e_size, TOP_E_REGEX, c->ptr.all->nodes);
+		int attr;
+		if (graph_attr_id(g, c->ptr.all->attributes, &attr))
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		if ((res = name_match_init(&match, c->ptr.all->nodes))) {
+			if (res == TOP_E_REGEX)
+				return return_error(e_text, e_size, TOP_E_REGEX,
+					c->ptr.all->nodes);
+			return return_error(e_text, e_size, res, "");
 		}
 
-		char *stack_name = name_stack_name(s);
-		if (!stack_name) return return_error(e_text, e_size, TOP_E_ALLOC, "");
-
-		for (int i = 0; i < g->n_nodes; i++) {
-			if (!regexec(&regex, g->nodes[i].name, 0, NULL, REG_EXTENDED)) {
-				if (strncmp(stack_name, g->nodes[i].name,
-					strlen(stack_name)) == 0)
-				{
-					if ((g->nodes[i].type == NODE_REPLACED) ||
-					(g->nodes[i].type == NODE_REPLACED_T))
-						continue;
-					selected_n++;
-					if (selected_n >= selected_cap) {
-						selected_cap += selected_blk;
-						selected = realloc(selected,
-							selected_cap * sizeof(int));
-						if (!selected) {
-							return return_error(e_text, e_size,
-								TOP_E_ALLOC, "");
-						}
-					}
-					selected[selected_n - 1] = i;
-				}
-			}
+		/* only the nodes under the module are candidates */
+		if (graph_select_prefixed(g, name_stack_name(s), &selected,
+			&selected_n))
+		{
+			name_match_free(&match);
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
 		}
-		free(stack_name);
-		regfree(&regex);
-		for (int n_a = 1; n_a < selected_n; n_a++) {
-			for (int n_b = 0; n_b < n_a; n_b++) {
-				int n_node_a = selected[n_a];
-				int n_node_b = selected[n_b];
-				if (g->nodes[n_node_a].type == NODE_NODE)
-					if (add_auto_gate_full_name(g,
-						&n_node_a,
-						g->nodes[n_node_a].name))
+		char *name = NULL;
+		size_t name_cap = 0;
+		graph_id_t n = 0;
+		for (graph_id_t i = 0; i < selected_n; i++) {
+			if (!graph_node_name(g, selected[i], &name, &name_cap)) {
+				free(selected);
+				name_match_free(&match);
+				return return_error(e_text, e_size, TOP_E_ALLOC, "");
+			}
+			if (name_match(&match, name))
+				selected[n++] = selected[i];
+		}
+		selected_n = n;
+		free(name);
+		name_match_free(&match);
+		for (graph_id_t n_a = 1; n_a < selected_n; n_a++) {
+			for (graph_id_t n_b = 0; n_b < n_a; n_b++) {
+				graph_id_t n_node_a = selected[n_a];
+				graph_id_t n_node_b = selected[n_b];
+				if (g->types[n_node_a] == NODE_NODE)
+					if (add_auto_gate(g, &n_node_a))
 						return return_error(e_text,
 							e_size, TOP_E_ALLOC, "");
-				if (g->nodes[n_node_b].type == NODE_NODE)
-					if (add_auto_gate_full_name(g,
-						&n_node_b,
-						g->nodes[n_node_b].name))
+				if (g->types[n_node_b] == NODE_NODE)
+					if (add_auto_gate(g, &n_node_b))
 						return return_error(e_text,
 							e_size, TOP_E_ALLOC, "");
 
 				if (graph_add_edge_id(g, n_node_a, n_node_b,
-						c->ptr.all->attributes))
+						attr))
 				{
-					return_error(e_text, e_size, TOP_E_CONN,
-						" %s %s", g->nodes[n_node_a].name,
-						g->nodes[n_node_b].name);
-					return TOP_E_CONN;
+					return conn_error(g, n_node_a, n_node_b,
+						e_text, e_size);
 				}
 			}
 		}
@@ -561,147 +877,1062 @@ traverse_and_add_conns (connection_wrapper_t *c, graph_t *g,
 		if ((res = graph_eval_and_add_edge(g, p, s, c, e_text, e_size)))
 			return res;
 	}
-	return 0;
+	res = 0;
+out:
+	/* an error leaves the loop variable bound */
+	while (p->n > mark)
+		param_stack_leave(p);
+	name_buf_free(&full_name);
+	free(nodes_to_connect);
+	return res;
 }
 
 static int
 graph_insert (graph_t *g, graph_t *g_prod, name_stack_t *s,
 	char *e_text, size_t e_size)
 {
-	(void) s;
 	int res;
 	char *stack_name = name_stack_name(s);
-	if (!stack_name) return return_error(e_text, e_size, TOP_E_ALLOC, "");
 
-	int name_buf_blk = 32;
-	int name_buf_cap = name_buf_blk;
-	char *name_buf = malloc(name_buf_cap);
-	if (!name_buf)
+	char *name_buf = NULL;
+	size_t name_buf_cap = 0;
+	char *name_prod = NULL;
+	size_t name_prod_cap = 0;
+
+	/* attribute ids of g_prod translated to the ones of g */
+	int *attr_map = malloc((g_prod->attrs->n_strs + 1) * sizeof(int));
+	if (!attr_map)
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	attr_map[0] = 0;
+	for (graph_id_t i = 0; i < g_prod->attrs->n_strs; i++) {
+		if (graph_attr_id(g, g_prod->attrs->strs[i], &attr_map[i + 1]))
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+
+	/* names of the inserted nodes in the trie of g */
+	graph_id_t *names = malloc((g_prod->n_nodes + 1) * sizeof(graph_id_t));
+	if (!names)
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 
-	for (int i = 0; i < g_prod->n_nodes; i++) {
-		int name_len = strlen(g_prod->nodes[i].name) +
-			strlen(stack_name) + 2;
+	for (graph_id_t i = 0; i < g_prod->n_nodes; i++) {
+		if (!graph_node_name(g_prod, i, &name_prod, &name_prod_cap))
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		size_t name_len = strlen(name_prod) + strlen(stack_name) + 2;
 		if (name_buf_cap < name_len) {
-			name_buf_cap = (1 + name_len / name_buf_blk) *
-				name_buf_blk;
-			name_buf = realloc(name_buf, name_buf_cap);
+			name_buf = realloc(name_buf, name_len);
 			if (!name_buf) {
 				return return_error(e_text, e_size,
 					TOP_E_ALLOC, "");
 			}
+			name_buf_cap = name_len;
+		}
+		sprintf(name_buf, "%s.%s", stack_name, name_prod);
+
+		if ((names[i] = name_trie_add(g->names, name_buf)) < 0)
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		if (graph_add_node_id(g, names[i], g_prod->types[i],
+			attr_map[g_prod->nodes[i].attr]))
+		{
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		}
+	}
+
+	for (graph_id_t i = 0; i < g_prod->n_nodes; i++) {
+		for (graph_id_t j = 0; j < g_prod->nodes[i].n_adj; j++) {
+			graph_id_t n = g_prod->nodes[i].adj[j].n;
+			if (i < n) continue;
+			if ((res = graph_add_edge_id(g,
+				graph_find_node_id(g, names[i]),
+				graph_find_node_id(g, names[n]),
+				attr_map[g_prod->nodes[i].adj[j].attr])))
+			{
+				if (res == TOP_E_CONN) {
+					name_trie_name(g->names, names[i],
+						&name_buf, &name_buf_cap);
+					name_trie_name(g->names, names[n],
+						&name_prod, &name_prod_cap);
+					return_error(e_text, e_size, TOP_E_CONN,
+						" %s %s", name_buf, name_prod);
+					return TOP_E_CONN;
+				} else {
+					return return_error(e_text, e_size, res, "");
+				}
+			}
+		}
+	}
+	free(names);
+	free(attr_map);
+	free(name_buf);
+	free(name_prod);
+	return 0;
+}
+
+/* expands the elements start .. end - 1 of the array of sm */
+static int
+expand_slice (network_definition_t *net, graph_t *g, name_stack_t *s,
+	param_stack_t *p, submodule_plain_t *sm, int start, int end,
+	char *e_text, size_t e_size)
+{
+	int res;
+	for (int j = start; j < end; j++) {
+		if (param_stack_enter_val(p, "index", j))
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		if ((res = enter_and_expand_module(net, g, s, p, sm, j,
+			e_text, e_size)))
+		{
+			return res;
+		}
+		param_stack_leave(p);
+	}
+	return 0;
+}
+
+/* Tells into how many tasks the array of sm is cut.  The elements of the
+ * array must not look at the graph outside of themselves, which is what
+ * modules that may be stamped do not, and no node may be named under an
+ * element yet: the connections of the element would find it. */
+static int
+expand_n_tasks (network_definition_t *net, graph_t *g, name_stack_t *s,
+	param_stack_t *p, submodule_plain_t *sm, int size)
+{
+	int n_threads = p->worker ? p->worker->pool->n_threads : p->n_threads;
+	if ((n_threads < 2) || !p->stamps || (p->stamps->g != g))
+		return 1;
+	module_t *module = find_module(net, sm->module);
+	if (!module || !stamp_allowed(p->stamps, module))
+		return 1;
+	int n_tasks = n_threads * EXPAND_TASKS;
+	if (n_tasks > size)
+		n_tasks = size;
+	if ((module->type == MODULE_SIMPLE) &&
+		(n_tasks > size / EXPAND_SIMPLE_MIN))
+	{
+		n_tasks = size / EXPAND_SIMPLE_MIN;
+	}
+	if (n_tasks < 2)
+		return 1;
+	char *full_name = NULL;
+	size_t full_name_cap = 0;
+	for (int j = 0; j < size; j++) {
+		if (!get_full_name(s, sm->name, j, &full_name, &full_name_cap) ||
+			(name_trie_find(g->names, full_name) >= 0))
+		{
+			n_tasks = 1;
+			break;
+		}
+	}
+	free(full_name);
+	return n_tasks;
+}
+
+/* Runs task on the param stack of w, over the bindings of its batch.
+ * The bindings, the recorders and the stamps of the stack belong to what
+ * w was doing when it took the task, so they are put aside meanwhile:
+ * the task sees only the bindings of its batch. */
+static void
+expand_task_run (expand_worker_t *w, expand_task_t *task)
+{
+	expand_batch_t *b = task->batch;
+	param_stack_t *p = w->p;
+	int n = p->n;
+	param_rec_t *recs = p->recs;
+	int n_recs = p->n_recs;
+	int cap_recs = p->cap_recs;
+	stamp_cache_t *stamps = p->stamps;
+
+	p->recs = NULL;
+	p->n_recs = 0;
+	p->cap_recs = 0;
+	name_stack_t *s = name_stack_create(b->prefix);
+	task->g = graph_create(GRAPH_ARENA | GRAPH_ADJ_SET);
+	p->stamps = task->g ? stamp_cache_create(task->g, b->net) : NULL;
+	param_stack_hide(p);
+	if (!s || !p->stamps ||
+		param_stack_enter_all(p, b->params, b->n_params) ||
+		param_stack_rec_begin(p))
+	{
+		task->res = return_error(task->e_text, b->e_size,
+			TOP_E_ALLOC, "");
+	} else {
+		task->res = expand_slice(b->net, task->g, s, p, b->sm,
+			task->start, task->end, task->e_text, b->e_size);
+		param_stack_rec_end(p, &task->reads, &task->n_reads);
+	}
+	while (p->n > n)
+		param_stack_leave(p);
+	param_stack_show(p);
+	free(p->recs);
+	p->recs = recs;
+	p->n_recs = n_recs;
+	p->cap_recs = cap_recs;
+	stamp_cache_destroy(p->stamps);
+	p->stamps = stamps;
+	if (s)
+		name_stack_destroy(s);
+}
+
+/* Takes the task w is to run next: the newest one of its own deque, or
+ * else the oldest one of the next deque that has any.  Tasks after one
+ * that failed are not run but done at once.  Called with the lock held. */
+static expand_task_t *
+expand_pool_take (expand_pool_t *pool, expand_worker_t *w)
+{
+	int self = w - pool->workers;
+	for (int i = 0; i < pool->n_threads; i++) {
+		expand_worker_t *v = &pool->workers[(self + i) % pool->n_threads];
+		while (v->top < v->bottom) {
+			expand_task_t *task = (v == w) ? v->tasks[--v->bottom] :
+				v->tasks[v->top++];
+			if (v->top == v->bottom)
+				v->top = v->bottom = 0;
+			if (task->k < task->batch->failed)
+				return task;
+			task->res = -1;
+			task->batch->n_done++;
+			pthread_cond_broadcast(&pool->cond);
+		}
+	}
+	return NULL;
+}
+
+/* called with the lock held */
+static void
+expand_task_done (expand_pool_t *pool, expand_task_t *task)
+{
+	expand_batch_t *b = task->batch;
+	if (task->res && (task->k < b->failed))
+		b->failed = task->k;
+	b->n_done++;
+	pthread_cond_broadcast(&pool->cond);
+}
+
+static void *
+expand_worker_run (void *arg)
+{
+	expand_worker_t *w = (expand_worker_t *) arg;
+	expand_pool_t *pool = w->pool;
+	pthread_mutex_lock(&pool->lock);
+	while (!pool->stop) {
+		expand_task_t *task = expand_pool_take(pool, w);
+		if (!task) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&pool->lock);
+		expand_task_run(w, task);
+		pthread_mutex_lock(&pool->lock);
+		expand_task_done(pool, task);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/* stops the pool of p, if it was started */
+static void
+expand_pool_destroy (param_stack_t *p)
+{
+	if (!p->worker)
+		return;
+	expand_pool_t *pool = p->worker->pool;
+	p->worker = NULL;
+	pthread_mutex_lock(&pool->lock);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	for (int k = 0; k < pool->n_threads; k++) {
+		expand_worker_t *w = &pool->workers[k];
+		if (w->started)
+			pthread_join(w->thread, NULL);
+		if (k > 0) {
+			if (w->p)
+				param_stack_destroy(w->p);
+			expr_cache_destroy(w->exprs);
+		}
+		free(w->tasks);
+	}
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->workers);
+	free(pool);
+}
+
+/* the number of processors online, or TOPOLOGIES_THREADS if that is set */
+static int
+expand_n_threads (void)
+{
+	char *env = getenv("TOPOLOGIES_THREADS");
+	long n_threads = env ? strtol(env, NULL, 10) :
+		sysconf(_SC_NPROCESSORS_ONLN);
+	if (n_threads < 1)
+		return 1;
+	if (n_threads > EXPAND_MAX_THREADS)
+		return EXPAND_MAX_THREADS;
+	return n_threads;
+}
+
+/* Starts the threads that expand tasks next to the one that expands the
+ * network with p, which is worker 0; they evaluate with views of its
+ * expression cache.  A thread that cannot be set up is left out; the
+ * others do its share. */
+static expand_pool_t *
+expand_pool_create (network_definition_t *net, param_stack_t *p)
+{
+	int n_threads = p->n_threads;
+	expand_pool_t *pool = (expand_pool_t *) calloc(1,
+		sizeof(expand_pool_t));
+	if (!pool)
+		return NULL;
+	pool->workers = (expand_worker_t *) calloc(n_threads,
+		sizeof(expand_worker_t));
+	if (!pool->workers) {
+		free(pool);
+		return NULL;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pool->net = net;
+	pool->n_threads = n_threads;
+	pool->workers[0].pool = pool;
+	pool->workers[0].exprs = p->exprs;
+	pool->workers[0].p = p;
+	for (int k = 1; k < n_threads; k++) {
+		expand_worker_t *w = &pool->workers[k];
+		w->pool = pool;
+		if (!(w->exprs = expr_cache_view(p->exprs)) ||
+			!(w->p = param_stack_create(w->exprs)))
+		{
+			continue;
+		}
+		w->p->worker = w;
+		w->started = !pthread_create(&w->thread, NULL,
+			expand_worker_run, w);
+	}
+	p->worker = &pool->workers[0];
+	return pool;
+}
+
+static void
+expand_batch_free (expand_batch_t *b)
+{
+	for (int k = 0; b->tasks && (k < b->n_tasks); k++) {
+		if (b->tasks[k].g)
+			topologies_graph_destroy(b->tasks[k].g);
+		free(b->tasks[k].reads);
+		free(b->tasks[k].e_text);
+	}
+	free(b->tasks);
+	free(b->params);
+	free(b->prefix);
+}
+
+/* makes the tasks of elements 0 .. size - 1 of the array of sm with the
+ * bindings of p and the name of s */
+static int
+expand_batch_init (expand_batch_t *b, network_definition_t *net,
+	name_stack_t *s, param_stack_t *p, submodule_plain_t *sm, int size,
+	int n_tasks, size_t e_size)
+{
+	b->net = net;
+	b->sm = sm;
+	b->n_tasks = n_tasks;
+	b->failed = n_tasks;
+	b->e_size = e_size + 1;
+	b->prefix = strdup(name_stack_name(s));
+	b->n_params = p->n;
+	b->params = (param_t *) malloc((p->n + 1) * sizeof(param_t));
+	b->tasks = (expand_task_t *) calloc(n_tasks, sizeof(expand_task_t));
+	if (!b->prefix || !b->params || !b->tasks)
+		return TOP_E_ALLOC;
+	memcpy(b->params, p->params, p->n * sizeof(param_t));
+	for (int k = 0; k < n_tasks; k++) {
+		expand_task_t *task = &b->tasks[k];
+		task->batch = b;
+		task->k = k;
+		task->start = (long) size * k / n_tasks;
+		task->end = (long) size * (k + 1) / n_tasks;
+		if (!(task->e_text = (char *) calloc(b->e_size, 1)))
+			return TOP_E_ALLOC;
+	}
+	return 0;
+}
+
+/* The elements of a submodule array do not see each other until the
+ * connections of the module around them are made.  A long array of
+ * elements that keep to themselves is cut into tasks of consecutive
+ * elements, which are pushed onto the deque of this thread for the
+ * threads of the pool to steal; the first array cut starts the pool.
+ * The tasks may cut the arrays in their elements into tasks again.
+ * Meanwhile this thread runs tasks too, its own first, until all of the
+ * array are done; then their graphs are
+ * appended in the order of the tasks.  The graph is the same as if all
+ * elements were expanded here, and so is the error, that of the first
+ * task that failed. */
+static int
+expand_array (network_definition_t *net, graph_t *g, name_stack_t *s,
+	param_stack_t *p, submodule_plain_t *sm, int size,
+	char *e_text, size_t e_size)
+{
+	int res = 0;
+	int n_tasks = expand_n_tasks(net, g, s, p, sm, size);
+	if ((n_tasks >= 2) && !p->worker && !expand_pool_create(net, p)) {
+		p->n_threads = 1;
+		n_tasks = 1;
+	}
+	if (n_tasks < 2)
+		return expand_slice(net, g, s, p, sm, 0, size, e_text, e_size);
+
+	expand_worker_t *w = p->worker;
+	expand_pool_t *pool = w->pool;
+	expand_batch_t b = { 0 };
+	if (expand_batch_init(&b, net, s, p, sm, size, n_tasks, e_size)) {
+		expand_batch_free(&b);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	pthread_mutex_lock(&pool->lock);
+	if (w->bottom + n_tasks > w->cap_tasks) {
+		int cap_tasks = w->bottom + n_tasks + EXPAND_TASK_BLK_SIZE;
+		expand_task_t **tasks = (expand_task_t **) realloc(w->tasks,
+			cap_tasks * sizeof(expand_task_t *));
+		if (!tasks) {
+			pthread_mutex_unlock(&pool->lock);
+			expand_batch_free(&b);
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		}
+		w->tasks = tasks;
+		w->cap_tasks = cap_tasks;
+	}
+	/* the first task is taken first from the bottom, stolen last */
+	for (int k = n_tasks - 1; k >= 0; k--)
+		w->tasks[w->bottom++] = &b.tasks[k];
+	pthread_cond_broadcast(&pool->cond);
+	while (b.n_done < b.n_tasks) {
+		/* taking may find the last tasks skipped */
+		expand_task_t *task = expand_pool_take(pool, w);
+		if (!task) {
+			if (b.n_done < b.n_tasks)
+				pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&pool->lock);
+		expand_task_run(w, task);
+		pthread_mutex_lock(&pool->lock);
+		expand_task_done(pool, task);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	for (int k = 0; k < n_tasks; k++) {
+		expand_task_t *task = &b.tasks[k];
+		if ((res = task->res)) {
+			if (e_text && e_size)
+				snprintf(e_text, e_size, "%s", task->e_text);
+			break;
+		}
+		if (graph_append(g, task->g) ||
+			param_stack_rec_reads(p, task->reads, task->n_reads))
+		{
+			res = return_error(e_text, e_size, TOP_E_ALLOC, "");
+			break;
+		}
+		topologies_graph_destroy(task->g);
+		task->g = NULL;
+	}
+	expand_batch_free(&b);
+	return res;
+}
+
+static int
+add_submodule (submodule_wrapper_t *smodule,
+	network_definition_t *net, graph_t *g,
+	name_stack_t *s, param_stack_t *p,
+	char *e_text, size_t e_size)
+{
+	int res;
+	if (smodule->type == SUBM_HAS_PROD) {
+		graph_t *g_a = graph_create(GRAPH_ARENA | GRAPH_ADJ_SET);
+		if (!g_a) {
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		}
+		graph_t *g_b = graph_create(GRAPH_ARENA | GRAPH_ADJ_SET);
+		if (!g_b) {
+			topologies_graph_destroy(g_a);
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		}
+
+		name_stack_t *s_tmp = name_stack_create("");
+		if ((res = add_submodule(smodule->ptr.prod->a,
+			net, g_a, s_tmp, p,
+			e_text, e_size)))
+		{
+			return res;
+		}
+		topologies_graph_compact((void **) &g_a, e_text, e_size);
+
+		if ((res = add_submodule(smodule->ptr.prod->b,
+			net, g_b, s_tmp, p,
+			e_text, e_size)))
+		{
+			return res;
+		}
+		topologies_graph_compact((void **) &g_b, e_text, e_size);
+		name_stack_destroy(s_tmp);
+		graph_t *g_prod = graph_create(GRAPH_ARENA | GRAPH_ADJ_SET);
+		if (!g_b) {
+			topologies_graph_destroy(g_a);
+			topologies_graph_destroy(g_b);
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		}
+		if (smodule->ptr.prod->type == PROD_IS_CART) {
+			if ((res = graphs_cart_product(g_a, g_b, g_prod, e_text, e_size))) {
+				return res;
+			}
+		} else if (smodule->ptr.prod->type == PROD_IS_TENS) {
+			if ((res = graphs_tens_product(g_a, g_b, g_prod, e_text, e_size))) {
+				return res;
+			}
+		} else if (smodule->ptr.prod->type == PROD_IS_LEX) {
+			if ((res = graphs_lex_product(g_a, g_b, g_prod, e_text, e_size))) {
+				return res;
+			}
+		} else if (smodule->ptr.prod->type == PROD_IS_STRONG) {
+			if ((res = graphs_strong_product(g_a, g_b, g_prod, e_text, e_size))) {
+				return res;
+			}
+		} else if (smodule->ptr.prod->type == PROD_IS_ROOT) {
+			if ((res = graphs_root_product(g_a, g_b, g_prod,
+				smodule->ptr.prod->root, e_text, e_size)))
+			{
+				return res;
+			}
+		}
+		topologies_graph_destroy(g_a);
+		topologies_graph_destroy(g_b);
+		if ((res = graph_insert(g, g_prod, s, e_text, e_size))) {
+			return res;
+		}
+		topologies_graph_destroy(g_prod);
+	} else if (smodule->type == SUBM_HAS_SUBM) {
+		submodule_plain_t *sm = smodule->ptr.subm;
+		for (int i = 0; i < sm->n_params; i++) {
+			if ((res = param_stack_enter(p, &sm->params[i], e_text,
+				e_size)))
+			{
+				return res;
+			}
+		}
+		int size;
+		double size_d;
+		if (sm->size == NULL) {
+			size = 0;
+		} else {
+			if ((res = param_stack_eval(p, sm->size, &size_d, e_text,
+				e_size)))
+			{
+				return res;
+			}
+			size = lrint(size_d);
+		}
+		if (size > 0) {
+			if ((res = expand_array(net, g, s, p, sm, size, e_text,
+				e_size)))
+			{
+				return res;
+			}
+		} else {
+			if ((res = enter_and_expand_module(net, g, s, p, sm, -1,
+				e_text, e_size)))
+			{
+				return res;
+			}
+		}
+		for (int i = 0; i < sm->n_params; i++) {
+			param_stack_leave(p);
+		}
+	} else { /* SUBM_HAD_COND */
+		submodule_cond_t *sc = smodule->ptr.cond;
+		double tmp_d;
+		if ((res = param_stack_eval(p, sc->condition, &tmp_d,
+			e_text, e_size)))
+		{
+			return res;
+		}
+		int condition = lrint(tmp_d);
+		if (condition) {
+			if ((res = add_submodule(sc->subm_then, net, g, s, p,
+				e_text, e_size)))
+			{
+				return res;
+			}
+		} else if (sc->subm_else) {
+			if ((res = add_submodule(sc->subm_else, net, g, s, p,
+				e_text, e_size)))
+			{
+				return res;
+			}
+		}
+	}
+	return 0;
+}
+
+static int
+replace_id_cmp (const void *a, const void *b)
+{
+	graph_id_t x = *(const graph_id_t *) a;
+	graph_id_t y = *(const graph_id_t *) b;
+	return (x > y) - (x < y);
+}
+
+/* returns the position of n in the sorted ids, or -1 */
+static graph_id_t
+replace_find (graph_id_t *ids, graph_id_t n_ids, graph_id_t n)
+{
+	graph_id_t lo = 0, hi = n_ids;
+	while (lo < hi) {
+		graph_id_t mid = lo + (hi - lo) / 2;
+		if (ids[mid] < n)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return ((lo < n_ids) && (ids[lo] == n)) ? lo : -1;
+}
+
+/* Moves the edges of the replaced nodes, sorted by id, to the nodes that
+ * took their names, succ[k] for victims[k].  Every neighbor of a replaced
+ * node is rewritten in one pass over its list, however many of its
+ * neighbors go.  A node with no successor keeps its edges. */
+static int
+replace_rewire (graph_t *g, graph_id_t *victims, graph_id_t *succ,
+	graph_id_t n_victims)
+{
+	int res;
+	graph_id_t n_neighs = 0;
+	for (graph_id_t k = 0; k < n_victims; k++) {
+		if (succ[k] >= 0)
+			n_neighs += g->nodes[victims[k]].n_adj;
+	}
+	graph_id_t *neighs = (graph_id_t *) malloc((n_neighs + 1) *
+		sizeof(graph_id_t));
+	if (!neighs)
+		return TOP_E_ALLOC;
+	n_neighs = 0;
+	for (graph_id_t k = 0; k < n_victims; k++) {
+		node_t *node = &g->nodes[victims[k]];
+		for (graph_id_t j = 0; (succ[k] >= 0) && (j < node->n_adj); j++)
+			neighs[n_neighs++] = node->adj[j].n;
+	}
+	qsort(neighs, n_neighs, sizeof(graph_id_t), replace_id_cmp);
+
+	for (graph_id_t i = 0; i < n_neighs; i++) {
+		if ((i > 0) && (neighs[i] == neighs[i - 1]))
+			continue;
+		node_t *neigh = &g->nodes[neighs[i]];
+		for (graph_id_t j = 0; j < neigh->n_adj; j++) {
+			graph_id_t n = neigh->adj[j].n;
+			if (g->types[n] != NODE_REPLACED_T)
+				continue;
+			graph_id_t k = replace_find(victims, n_victims, n);
+			if ((k >= 0) && (succ[k] >= 0))
+				graph_adj_set_n(neigh, j, succ[k]);
+		}
+	}
+	free(neighs);
+
+	graph_id_t empty = name_trie_add(g->names, "");
+	if (empty < 0)
+		return TOP_E_ALLOC;
+	for (graph_id_t k = 0; k < n_victims; k++) {
+		graph_id_t i = victims[k];
+		graph_set_type(g, i, NODE_REPLACED);
+		g->n_dead++;
+		if (succ[k] < 0)
+			continue;
+		node_t *node = &g->nodes[succ[k]];
+		for (graph_id_t j = 0; j < g->nodes[i].n_adj; j++) {
+			edge_t *e = &g->nodes[i].adj[j];
+			if (!graph_adj_has(g, node, e->n) &&
+				(res = graph_adj_push(g, node, e->n, e->attr)))
+			{
+				return res;
+			}
+		}
+		g->name_ids[i] = empty;
+		graph_adj_clear(&g->nodes[i]);
+	}
+	return 0;
+}
+
+/* Replaces the nodes under the module whose names match replace->nodes
+ * with the nodes of the same names in the expansion of
+ * replace->submodule. */
+static int
+do_replace (replace_t *replace,
+	network_definition_t *net, graph_t *g,
+	name_stack_t *s, param_stack_t *p,
+	char *e_text, size_t e_size)
+{
+	name_match_t match;
+	graph_id_t *victims;
+	graph_id_t n_victims;
+	int res;
+
+	if ((res = name_match_init(&match, replace->nodes))) {
+		if (res == TOP_E_REGEX)
+			return return_error(e_text, e_size, TOP_E_REGEX,
+				replace->nodes);
+		return return_error(e_text, e_size, res, "");
+	}
+	if (graph_select_prefixed(g, name_stack_name(s), &victims,
+		&n_victims))
+	{
+		name_match_free(&match);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	char *name = NULL;
+	size_t name_cap = 0;
+	graph_id_t n = 0;
+	for (graph_id_t i = 0; i < n_victims; i++) {
+		if (!graph_node_name(g, victims[i], &name, &name_cap)) {
+			free(victims);
+			name_match_free(&match);
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		}
+		if (name_match(&match, name))
+			victims[n++] = victims[i];
+	}
+	n_victims = n;
+	free(name);
+	name_match_free(&match);
+
+	/* the marked nodes are skipped by lookups, names in the submodule
+	 * resolve to its own nodes */
+	for (graph_id_t k = 0; k < n_victims; k++)
+		graph_set_type(g, victims[k], NODE_REPLACED_T);
+	/* the ids in victims must outlive the replacements nested in the
+	 * submodule, which do not vacuum meanwhile */
+	g->n_replacing++;
+	res = add_submodule(replace->submodule, net, g, s, p, e_text, e_size);
+	g->n_replacing--;
+	if (res) {
+		free(victims);
+		return res;
+	}
+
+	graph_id_t *succ = (graph_id_t *) malloc((n_victims + 1) *
+		sizeof(graph_id_t));
+	if (!succ) {
+		free(victims);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	for (graph_id_t k = 0; k < n_victims; k++)
+		succ[k] = graph_find_node_id(g, g->name_ids[victims[k]]);
+	res = replace_rewire(g, victims, succ, n_victims);
+	free(succ);
+	free(victims);
+	if (res)
+		return return_error(e_text, e_size, res, "");
+
+	if ((g->n_replacing == 0) && (g->n_dead >= VACUUM_MIN_DEAD) &&
+		(g->n_dead > g->n_nodes / VACUUM_DEAD_SHARE))
+	{
+		if (graph_vacuum(g))
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	return 0;
+}
+
+static int
+expand_module (graph_t *g, module_t *module, network_definition_t *net,
+	name_stack_t *s, param_stack_t *p, char *e_text, size_t e_size)
+{
+	int res;
+	for (int i = 0; i < module->n_params; i++) {
+		if ((res = param_stack_enter(p, &module->params[i], e_text, e_size)))
+			return res;
+	}
+	if (module->type == MODULE_SIMPLE) {
+		/* add gates and connect them to the node */
+		char *name_s = name_stack_name(s);
+		char *full_name = NULL;
+		size_t full_name_cap = 0;
+		int attr;
+		if (graph_attr_id(g, module->attributes, &attr))
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		if (graph_add_node(g, name_s, NODE_NODE, attr))
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		for (int i = 0; i < module->n_gates; i++) {
+			double size_d;
+			if ((res = param_stack_eval(p, module->gates[i].size,
+				&size_d, e_text, e_size)))
+			{
+				free(full_name);
+				return res;
+			}
+			int size = lrint(size_d);
+			if (size == 0) {
+				if ((res = add_gate(g, s, name_s,
+					&module->gates[i], -1, &full_name,
+					&full_name_cap, e_text, e_size)))
+				{
+					free(full_name);
+					return res;
+				}
+			} else {
+				for (int j = 0; j < size; j++) {
+					if ((res = add_gate(g, s, name_s,
+						&module->gates[i], j, &full_name,
+						&full_name_cap, e_text, e_size)))
+					{
+						free(full_name);
+						return res;
+					}
+				}
+			}
+		}
+		free(full_name);
+	} else {
+		/* add gates, add submodules, add connections, do replacements */
+		char *full_name = NULL;
+		size_t full_name_cap = 0;
+		for (int i = 0; i < module->n_gates; i++) {
+			double size_d;
+			if ((res = param_stack_eval(p, module->gates[i].size,
+				&size_d, e_text, e_size)))
+			{
+				return res;
+			}
+			int size = lrint(size_d);
+			if (size == 0) {
+				if (!get_full_name(s, module->gates[i].name, -1,
+					&full_name, &full_name_cap))
+				{
+					return return_error(e_text, e_size, TOP_E_ALLOC, "");
+				}
+				if (graph_add_node(g, full_name, NODE_GATE, 0))
+					return return_error(e_text, e_size, TOP_E_ALLOC, "");
+			} else {
+				for (int j = 0; j < size; j++) {
+					if (!get_full_name(s, module->gates[i].name,
+						j, &full_name, &full_name_cap))
+					{
+						return return_error(e_text, e_size, TOP_E_ALLOC, "");
+					}
+					if (graph_add_node(g, full_name, NODE_GATE, 0))
+						return return_error(e_text, e_size, TOP_E_ALLOC, "");
+				}
+			}
+		}
+		free(full_name);
+		for (int i = 0; i < module->n_submodules; i++) {
+			submodule_wrapper_t *smodule = &module->submodules[i];
+			if ((res = add_submodule(smodule, net, g, s, p,
+				e_text, e_size)))
+			{
+				return res;
+			}
+		}
+		for (int i = 0; i < module->n_connections; i++) {
+			if ((res = traverse_and_add_conns(&module->connections[i],
+				g, p, s, e_text, e_size)))
+			{
+				return res;
+			}
+		}
+		for (int i = 0; i < module->n_replace; i++) {
+			if ((res = do_replace(&module->replace[i], net,
+				g, s, p, e_text, e_size)))
+			{
+				return res;
+			}
+		}
+	}
+	for (int i = 0; i < module->n_params; i++) {
+		param_stack_leave(p);
+	}
+	return 0;
+}
+
+/* the upper bounds grow quadratically with all-match connections and
+ * products, so they saturate at LONG_MAX; all counts are non-negative */
+static long
+size_sum (long a, long b)
+{
+	return (a > LONG_MAX - b) ? LONG_MAX : a + b;
+}
+
+static long
+size_mul (long a, long b)
+{
+	return (a && (b > LONG_MAX / a)) ? LONG_MAX : a * b;
+}
+
+static void
+size_add (graph_size_t *sz, long nodes, long gates, long edges)
+{
+	sz->n_nodes = size_sum(sz->n_nodes, nodes);
+	sz->max_nodes = size_sum(sz->max_nodes, nodes);
+	sz->n_gates = size_sum(sz->n_gates, gates);
+	sz->max_gates = size_sum(sz->max_gates, gates);
+	sz->n_edges = size_sum(sz->n_edges, edges);
+	sz->max_edges = size_sum(sz->max_edges, edges);
+}
+
+static int
+size_eval_range (param_stack_t *p, char *r_start, char *r_end, int *start,
+	int *end, char *e_text, size_t e_size)
+{
+	int res;
+	double tmp_d;
+	if ((res = param_stack_eval(p, r_start, &tmp_d, e_text, e_size)))
+		return res;
+	*start = lrint(tmp_d);
+	if ((res = param_stack_eval(p, r_end, &tmp_d, e_text, e_size)))
+		return res;
+	*end = lrint(tmp_d);
+	if (*start > *end) {
+		return return_error(e_text, e_size, TOP_E_LOOP,
+			"%d > %d\n", *start, *end);
+	}
+	return 0;
+}
+
+static int
+size_conns (connection_wrapper_t *c, param_stack_t *p, graph_size_t *sz,
+	char *e_text, size_t e_size)
+{
+	int res;
+	int start, end;
+	long n_links = 0;
+	if (c->type == CONN_HAS_LOOP) {
+		if ((res = size_eval_range(p, c->ptr.loop->start,
+			c->ptr.loop->end, &start, &end, e_text, e_size)))
+		{
+			return res;
+		}
+		for (int j = start; j < end; j++) {
+			if (param_stack_enter_val(p, c->ptr.loop->loop, j))
+				return return_error(e_text, e_size, TOP_E_ALLOC, "");
+			if ((res = size_conns(c->ptr.loop->conn, p, sz,
+				e_text, e_size)))
+			{
+				return res;
+			}
+			param_stack_leave(p);
+		}
+	} else if (c->type == CONN_HAS_ALLLIST) {
+		if ((res = size_eval_range(p, c->ptr.alllist->start,
+			c->ptr.alllist->end, &start, &end, e_text, e_size)))
+		{
+			return res;
+		}
+		if (end > start)
+			n_links = (long) (end - start) * (end - start - 1) / 2;
+	} else if (c->type == CONN_HAS_LINE) {
+		if ((res = size_eval_range(p, c->ptr.line->start,
+			c->ptr.line->end, &start, &end, e_text, e_size)))
+		{
+			return res;
+		}
+		if (end > start)
+			n_links = end - start - 1;
+	} else if (c->type == CONN_HAS_RING) {
+		if ((res = size_eval_range(p, c->ptr.ring->start,
+			c->ptr.ring->end, &start, &end, e_text, e_size)))
+		{
+			return res;
 		}
-		sprintf(name_buf, "%s.%s", stack_name, g_prod->nodes[i].name);
-
-		if (graph_add_node(g, name_buf,
-			g_prod->nodes[i].type,
-			g_prod->nodes[i].attributes))
+		if (end > start)
+			n_links = end - start;
+	} else if (c->type == CONN_HAS_COND) {
+		double tmp_d;
+		if ((res = param_stack_eval(p, c->ptr.cond->condition, &tmp_d,
+			e_text, e_size)))
 		{
-			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+			return res;
 		}
-	}
-
-	char *name_buf_2 = malloc(name_buf_cap);
-	if (!name_buf_2)
-		return return_error(e_text, e_size, TOP_E_ALLOC, "");
-	for (int i = 0; i < g_prod->n_nodes; i++) {
-		for (int j = 0; j < g_prod->nodes[i].n_adj; j++) {
-			if (i < g_prod->nodes[i].adj[j].n) continue;
-			sprintf(name_buf, "%s.%s", stack_name, g_prod->nodes[i].name);
-			sprintf(name_buf_2, "%s.%s", stack_name,
-				g_prod->nodes[g_prod->nodes[i].adj[j].n].name);
-			if ((res = graph_add_edge_name(g, name_buf, name_buf_2,
-				g_prod->nodes[i].adj[j].attributes)))
+		if (lrint(tmp_d)) {
+			if ((res = size_conns(c->ptr.cond->conn_then, p, sz,
+				e_text, e_size)))
 			{
-				if (res == TOP_E_CONN) {
-					return_error(e_text, e_size, TOP_E_CONN,
-						" %s %s", name_buf, name_buf_2);
-					return TOP_E_CONN;
-				} else {
-					return return_error(e_text, e_size, res, "");
-				}
+				return res;
+			}
+		} else if (c->ptr.cond->conn_else) {
+			if ((res = size_conns(c->ptr.cond->conn_else, p, sz,
+				e_text, e_size)))
+			{
+				return res;
 			}
 		}
+	} else if (c->type == CONN_HAS_ALL) {
+		/* any node built so far may match */
+		long k = size_sum(sz->max_nodes, sz->max_gates);
+		long pairs = (k > 0) ? size_mul(k, k - 1) / 2 : 0;
+		sz->max_gates = size_sum(sz->max_gates, size_mul(2, pairs));
+		sz->max_edges = size_sum(sz->max_edges, size_mul(3, pairs));
+	} else if (c->type == CONN_HAS_CONN) {
+		/* the edge itself, auto gates only for NODE_NODE ends */
+		size_add(sz, 0, 0, 1);
+		sz->max_gates = size_sum(sz->max_gates, 2);
+		sz->max_edges = size_sum(sz->max_edges, 2);
 	}
-	free(stack_name);
-	free(name_buf);
-	free(name_buf_2);
+	/* lists get a pair of fresh auto gates per link */
+	size_add(sz, 0, size_mul(2, n_links), size_mul(3, n_links));
 	return 0;
 }
 
 static int
-add_submodule (submodule_wrapper_t *smodule,
-	network_definition_t *net, graph_t *g,
-	name_stack_t *s, param_stack_t *p,
-	char *e_text, size_t e_size)
+size_module (module_t *module, network_definition_t *net, param_stack_t *p,
+	graph_size_t *sz, char *e_text, size_t e_size);
+
+static int
+size_submodule (submodule_wrapper_t *smodule, network_definition_t *net,
+	param_stack_t *p, graph_size_t *sz, char *e_text, size_t e_size)
 {
 	int res;
 	if (smodule->type == SUBM_HAS_PROD) {
-		graph_t *g_a = graph_create();
-		if (!g_a) {
-			return return_error(e_text, e_size, TOP_E_ALLOC, "");
-		}
-		graph_t *g_b = graph_create();
-		if (!g_b) {
-			topologies_graph_destroy(g_a);
-			return return_error(e_text, e_size, TOP_E_ALLOC, "");
-		}
-
-		name_stack_t *s_tmp = name_stack_create("");
-		if ((res = add_submodule(smodule->ptr.prod->a,
-			net, g_a, s_tmp, p,
+		graph_size_t a = { 0 }, b = { 0 };
+		if ((res = size_submodule(smodule->ptr.prod->a, net, p, &a,
 			e_text, e_size)))
 		{
 			return res;
 		}
-		topologies_graph_compact((void **) &g_a, e_text, e_size);
-
-		if ((res = add_submodule(smodule->ptr.prod->b,
-			net, g_b, s_tmp, p,
+		if ((res = size_submodule(smodule->ptr.prod->b, net, p, &b,
 			e_text, e_size)))
 		{
 			return res;
 		}
-		topologies_graph_compact((void **) &g_b, e_text, e_size);
-		free(s_tmp->name);
-		free(s_tmp);
-		graph_t *g_prod = graph_create();
-		if (!g_b) {
-			topologies_graph_destroy(g_a);
-			topologies_graph_destroy(g_b);
-			return return_error(e_text, e_size, TOP_E_ALLOC, "");
-		}
-		if (smodule->ptr.prod->type == PROD_IS_CART) {
-			if ((res = graphs_cart_product(g_a, g_b, g_prod, e_text, e_size))) {
-				return res;
-			}
-		} else if (smodule->ptr.prod->type == PROD_IS_TENS) {
-			if ((res = graphs_tens_product(g_a, g_b, g_prod, e_text, e_size))) {
-				return res;
-			}
-		} else if (smodule->ptr.prod->type == PROD_IS_LEX) {
-			if ((res = graphs_lex_product(g_a, g_b, g_prod, e_text, e_size))) {
-				return res;
-			}
-		} else if (smodule->ptr.prod->type == PROD_IS_STRONG) {
-			if ((res = graphs_strong_product(g_a, g_b, g_prod, e_text, e_size))) {
-				return res;
-			}
-		} else if (smodule->ptr.prod->type == PROD_IS_ROOT) {
-			if ((res = graphs_root_product(g_a, g_b, g_prod,
-				smodule->ptr.prod->root, e_text, e_size)))
-			{
-				return res;
-			}
-		}
-		topologies_graph_destroy(g_a);
-		topologies_graph_destroy(g_b);
-		if ((res = graph_insert(g, g_prod, s, e_text, e_size))) {
-			return res;
+		/* compaction keeps the nodes and turns gate chains into
+		 * edges, so the factors' totals bound the compacted sizes */
+		long na = a.max_nodes, ea = a.max_edges;
+		long nb = b.max_nodes, eb = b.max_edges;
+		long edges = 0;
+		switch (smodule->ptr.prod->type) {
+		case PROD_IS_CART:
+			edges = size_sum(size_mul(na, eb), size_mul(nb, ea));
+			break;
+		case PROD_IS_TENS:
+			edges = size_mul(2, size_mul(ea, eb));
+			break;
+		case PROD_IS_LEX:
+			edges = size_sum(size_mul(na, eb),
+				size_mul(size_mul(nb, nb), ea));
+			break;
+		case PROD_IS_STRONG:
+			edges = size_sum(size_sum(size_mul(na, eb),
+				size_mul(nb, ea)), size_mul(2, size_mul(ea, eb)));
+			break;
+		case PROD_IS_ROOT:
+			edges = size_sum(ea, size_mul(na, eb));
+			break;
 		}
-		topologies_graph_destroy(g_prod);
+		sz->max_nodes = size_sum(sz->max_nodes, size_mul(na, nb));
+		sz->max_edges = size_sum(sz->max_edges, edges);
 	} else if (smodule->type == SUBM_HAS_SUBM) {
 		submodule_plain_t *sm = smodule->ptr.subm;
+		module_t *module = find_module(net, sm->module);
+		if (module == NULL) {
+			return return_error(e_text, e_size, TOP_E_NOMOD,
+				": %s", sm->module);
+		}
 		for (int i = 0; i < sm->n_params; i++) {
 			if ((res = param_stack_enter(p, &sm->params[i], e_text,
 				e_size)))
@@ -709,11 +1940,9 @@ add_submodule (submodule_wrapper_t *smodule,
 				return res;
 			}
 		}
-		int size;
+		int size = 0;
 		double size_d;
-		if (sm->size == NULL) {
-			size = 0;
-		} else {
+		if (sm->size != NULL) {
 			if ((res = param_stack_eval(p, sm->size, &size_d, e_text,
 				e_size)))
 			{
@@ -722,28 +1951,19 @@ add_submodule (submodule_wrapper_t *smodule,
 			size = lrint(size_d);
 		}
 		if (size > 0) {
-			char index[11];
-			raw_param_t tmp_raw_param = { "index", index };
 			for (int j = 0; j < size; j++) {
-				sprintf(index, "%d", j);
-				if ((res = param_stack_enter(p, &tmp_raw_param, e_text,
+				if (param_stack_enter_val(p, "index", j))
+					return return_error(e_text, e_size, TOP_E_ALLOC, "");
+				if ((res = size_module(module, net, p, sz, e_text,
 					e_size)))
 				{
 					return res;
 				}
-				if ((res = enter_and_expand_module(net, g, s, p,
-					sm, j, e_text, e_size)))
-				{
-					return res;
-				}
 				param_stack_leave(p);
 			}
 		} else {
-			if ((res = enter_and_expand_module(net, g, s, p, sm, -1,
-				e_text, e_size)))
-			{
+			if ((res = size_module(module, net, p, sz, e_text, e_size)))
 				return res;
-			}
 		}
 		for (int i = 0; i < sm->n_params; i++) {
 			param_stack_leave(p);
@@ -756,15 +1976,14 @@ add_submodule (submodule_wrapper_t *smodule,
 		{
 			return res;
 		}
-		int condition = lrint(tmp_d);
-		if (condition) {
-			if ((res = add_submodule(sc->subm_then, net, g, s, p,
+		if (lrint(tmp_d)) {
+			if ((res = size_submodule(sc->subm_then, net, p, sz,
 				e_text, e_size)))
 			{
 				return res;
 			}
 		} else if (sc->subm_else) {
-			if ((res = add_submodule(sc->subm_else, net, g, s, p,
+			if ((res = size_submodule(sc->subm_else, net, p, sz,
 				e_text, e_size)))
 			{
 				return res;
@@ -775,171 +1994,51 @@ add_submodule (submodule_wrapper_t *smodule,
 }
 
 static int
-do_replace (replace_t *replace,
-	network_definition_t *net, graph_t *g,
-	name_stack_t *s, param_stack_t *p,
-	char *e_text, size_t e_size)
-{
-	regex_t regex;
-	int res;
-
-	if (regcomp(&regex, replace->nodes, 0)) {
-		return return_error(e_text, e_size, TOP_E_REGEX, replace->nodes);
-	}
-
-	char *stack_name = name_stack_name(s);
-	if (!stack_name) return return_error(e_text, e_size, TOP_E_ALLOC, "");
-
-	for (int i = 0; i < g->n_nodes; i++) {
-		if (!regexec(&regex, g->nodes[i].name, 0, NULL, REG_EXTENDED)) {
-			if (strncmp(stack_name, g->nodes[i].name, strlen(stack_name)) == 0)
-				g->nodes[i].type = NODE_REPLACED_T;
-		}
-	}
-	free(stack_name);
-	regfree(&regex);
-	if ((res = add_submodule(replace->submodule, net, g, s, p, e_text, e_size)))
-		return res;
-
-	for (int i = 0; i < g->n_nodes; i++) {
-		if (g->nodes[i].type == NODE_REPLACED_T) {
-			int node = graph_find_node(g, g->nodes[i].name);
-			if (node < 0) {
-				g->nodes[i].type = NODE_REPLACED;
-				continue;
-			}
-			for (int j = 0; j < g->nodes[i].n_adj; j++) {
-				int k;
-				for (k = 0; k < g->nodes[g->nodes[i].adj[j].n].n_adj; k++) {
-					if (g->nodes[g->nodes[i].adj[j].n].adj[k].n == i) {
-						g->nodes[g->nodes[i].adj[j].n].adj[k].n = node;
-						break;
-					}
-				}
-				bool seen = false;
-				for (int l = 0; l < g->nodes[node].n_adj; l++) {
-					if (g->nodes[node].adj[l].n == g->nodes[i].adj[j].n)
-						seen = true;
-				}
-				if (!seen) {
-					node_t *node_a = &(g->nodes[node]);
-					int ii = node_a->n_adj;
-					if (node_a->n_adj == node_a->cap_adj) {
-						node_a->cap_adj += ADJ_BLK_SIZE;
-						node_a->adj = (edge_t *) realloc(node_a->adj,
-							node_a->cap_adj * sizeof(edge_t));
-						if (!node_a->adj)
-							return TOP_E_ALLOC;
-						memset(node_a->adj + (node_a->cap_adj - ADJ_BLK_SIZE), 0,
-							ADJ_BLK_SIZE * sizeof(edge_t));
-					}
-					node_a->adj[ii].n = g->nodes[i].adj[j].n;
-					node_a->adj[ii].attributes = g->nodes[i].adj[j].attributes;
-					node_a->n_adj++;
-				}
-			}
-			g->nodes[i].type = NODE_REPLACED;
-			memset(g->nodes[i].name, 0, strlen(g->nodes[i].name));
-			g->nodes[i].n_adj = 0;
-		}
-	}
-	return 0;
-}
-
-static int
-expand_module (graph_t *g, module_t *module, network_definition_t *net,
-	name_stack_t *s, param_stack_t *p, char *e_text, size_t e_size)
+size_module (module_t *module, network_definition_t *net, param_stack_t *p,
+	graph_size_t *sz, char *e_text, size_t e_size)
 {
 	int res;
 	for (int i = 0; i < module->n_params; i++) {
 		if ((res = param_stack_enter(p, &module->params[i], e_text, e_size)))
 			return res;
 	}
-	if (module->type == MODULE_SIMPLE) {
-		/* add gates and connect them to the node */
-		char *name_s = name_stack_name(s);
-		if (!name_s)
-			return return_error(e_text, e_size, TOP_E_ALLOC, "");
-		if (graph_add_node(g, name_s, NODE_NODE, module->attributes)) {
-			free(name_s);
-			return return_error(e_text, e_size, TOP_E_ALLOC, "");
-		}
-		for (int i = 0; i < module->n_gates; i++) {
-			double size_d;
-			if ((res = param_stack_eval(p, module->gates[i].size,
-				&size_d, e_text, e_size)))
-			{
-				return res;
-			}
-			int size = lrint(size_d);
-			if (size == 0) {
-				if ((res = add_gate(g, s, name_s,
-					&module->gates[i], -1, e_text, e_size)))
-				{
-					free(name_s);
-					return res;
-				}
-			} else {
-				for (int j = 0; j < size; j++) {
-					if ((res = add_gate(g, s, name_s,
-						&module->gates[i], j, e_text,
-						e_size)))
-					{
-						free(name_s);
-						return res;
-					}
-				}
-			}
-		}
-		free(name_s);
-	} else {
-		/* add gates, add submodules, add connections, do replacements */
-		for (int i = 0; i < module->n_gates; i++) {
-			double size_d;
-			if ((res = param_stack_eval(p, module->gates[i].size,
-				&size_d, e_text, e_size)))
-			{
-				return res;
-			}
-			int size = lrint(size_d);
-			if (size == 0) {
-				char *full_name = get_full_name(s,
-					module->gates[i].name, -1);
-				if (!full_name)
-					return return_error(e_text, e_size, TOP_E_ALLOC, "");
-				if (graph_add_node(g, full_name, NODE_GATE, NULL))
-					return return_error(e_text, e_size, TOP_E_ALLOC, "");
-				free(full_name);
-			} else {
-				for (int j = 0; j < size; j++) {
-					char *full_name = get_full_name(s,
-						module->gates[i].name, j);
-					if (!full_name)
-						return return_error(e_text, e_size, TOP_E_ALLOC, "");
-					if (graph_add_node(g, full_name, NODE_GATE, NULL))
-						return return_error(e_text, e_size, TOP_E_ALLOC, "");
-					free(full_name);
-				}
-			}
+	bool simple = (module->type == MODULE_SIMPLE);
+	if (simple)
+		size_add(sz, 1, 0, 0);
+	for (int i = 0; i < module->n_gates; i++) {
+		double size_d;
+		if ((res = param_stack_eval(p, module->gates[i].size,
+			&size_d, e_text, e_size)))
+		{
+			return res;
 		}
+		int size = lrint(size_d);
+		if (size == 0)
+			size = 1;
+		else if (size < 0)
+			size = 0;
+		/* gates of a simple module are connected to its node */
+		size_add(sz, 0, size, simple ? size : 0);
+	}
+	if (!simple) {
 		for (int i = 0; i < module->n_submodules; i++) {
-			submodule_wrapper_t *smodule = &module->submodules[i];
-			if ((res = add_submodule(smodule, net, g, s, p,
-				e_text, e_size)))
+			if ((res = size_submodule(&module->submodules[i], net, p,
+				sz, e_text, e_size)))
 			{
 				return res;
 			}
 		}
 		for (int i = 0; i < module->n_connections; i++) {
-			if ((res = traverse_and_add_conns(&module->connections[i],
-				g, p, s, e_text, e_size)))
+			if ((res = size_conns(&module->connections[i], p, sz,
+				e_text, e_size)))
 			{
 				return res;
 			}
 		}
+		/* replaced nodes keep their slots until compaction */
 		for (int i = 0; i < module->n_replace; i++) {
-			if ((res = do_replace(&module->replace[i], net,
-				g, s, p, e_text, e_size)))
+			if ((res = size_submodule(module->replace[i].submodule,
+				net, p, sz, e_text, e_size)))
 			{
 				return res;
 			}
@@ -951,6 +2050,68 @@ expand_module (graph_t *g, module_t *module, network_definition_t *net,
 	return 0;
 }
 
+/* compiles the expressions of net anew, after it has been read */
+static int
+network_compile (network_definition_t *net, char *e_text, size_t e_size)
+{
+	expr_cache_destroy(net->exprs);
+	net->exprs = NULL;
+	return expr_cache_create(net, &net->exprs, e_text, e_size);
+}
+
+/* walks the definition like topologies_definition_to_graph does,
+ * evaluating parameters, sizes and loop bounds, but creates no nodes */
+static int
+definition_size (network_definition_t *net, graph_size_t *sz,
+	char *e_text, size_t e_size)
+{
+	int res;
+	memset(sz, 0, sizeof(graph_size_t));
+	if (net->network == NULL)
+		return return_error(e_text, e_size, TOP_E_NONET, "");
+	module_t *root_module = find_module(net, net->network->module);
+	if (root_module == NULL) {
+		return return_error(e_text, e_size, TOP_E_NOMOD, " %s",
+			net->network->module);
+	}
+	if (!net->exprs && (res = network_compile(net, e_text, e_size)))
+		return res;
+	param_stack_t *p = param_stack_create(net->exprs);
+	if (!p)
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	for (int i = 0; i < net->network->n_params; i++) {
+		if ((res = param_stack_enter(p, &net->network->params[i],
+			e_text, e_size)))
+		{
+			param_stack_destroy(p);
+			return res;
+		}
+	}
+	res = size_module(root_module, net, p, sz, e_text, e_size);
+	param_stack_destroy(p);
+	return res;
+}
+
+int
+topologies_definition_size (void *v, long *n_nodes, long *n_gates,
+	long *n_edges, bool *exact, char *e_text, size_t e_size)
+{
+	graph_size_t sz;
+	int res;
+	if ((res = definition_size((network_definition_t *) v, &sz, e_text,
+		e_size)))
+	{
+		return res;
+	}
+	*n_nodes = sz.max_nodes;
+	*n_gates = sz.max_gates;
+	*n_edges = sz.max_edges;
+	*exact = (sz.n_nodes == sz.max_nodes) &&
+		(sz.n_gates == sz.max_gates) &&
+		(sz.n_edges == sz.max_edges);
+	return 0;
+}
+
 int
 topologies_definition_to_graph (void *v, void **r_g, char *e_text, size_t e_size)
 {
@@ -967,93 +2128,121 @@ topologies_definition_to_graph (void *v, void **r_g, char *e_text, size_t e_size
 	param_stack_t *p;
 	int res;
 
-	g = graph_create();
+	if (!net->exprs && (res = network_compile(net, e_text, e_size)))
+		return res;
+	g = graph_create(GRAPH_ARENA | GRAPH_ADJ_SET);
 	if (!g)
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	/* errors of the dry run are left for the expansion to report */
+	graph_size_t size;
+	if (!definition_size(net, &size, NULL, 0) &&
+		(size.n_nodes + size.n_gates <= GRAPH_ID_MAX) &&
+		(size.n_edges <= GRAPH_ID_MAX))
+	{
+		if (graph_reserve(g, size.n_nodes + size.n_gates,
+			size.n_edges))
+		{
+			topologies_graph_destroy(g);
+			return return_error(e_text, e_size, TOP_E_ALLOC, "");
+		}
+	}
 	s = name_stack_create("n");
 	if (!s) {
-		free(g->nodes);
-		free(g);
+		topologies_graph_destroy(g);
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 	}
-	p = param_stack_create();
+	p = param_stack_create(net->exprs);
 	if (!p) {
-		free(g->nodes);
-		free(g);
-		free(s->name);
-		free(s);
+		topologies_graph_destroy(g);
+		name_stack_destroy(s);
+		return return_error(e_text, e_size, TOP_E_ALLOC, "");
+	}
+	p->stamps = stamp_cache_create(g, net);
+	if (!p->stamps) {
+		param_stack_destroy(p);
+		topologies_graph_destroy(g);
+		name_stack_destroy(s);
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 	}
+	p->n_threads = expand_n_threads();
 	for (int i = 0; i < net->network->n_params; i++) {
 		if ((res = param_stack_enter(p, &net->network->params[i],
 			e_text, e_size)))
 		{
+			stamp_cache_destroy(p->stamps);
+			expand_pool_destroy(p);
 			param_stack_destroy(p);
-			free(s->name);
-			free(s);
+			name_stack_destroy(s);
 			return res;
 		}
 	}
 	if ((res = expand_module(g, root_module, net, s, p, e_text, e_size)))
 	{
+		stamp_cache_destroy(p->stamps);
+		expand_pool_destroy(p);
 		param_stack_destroy(p);
 		topologies_graph_destroy(g);
-		free(s->name);
-		free(s);
+		name_stack_destroy(s);
 		return res;
 	}
 
 	for (int i = 0; i < net->network->n_params; i++) {
 		param_stack_leave(p);
 	}
+	stamp_cache_destroy(p->stamps);
+	expand_pool_destroy(p);
 	param_stack_destroy(p);
-	free(s->name);
-	free(s);
+	name_stack_destroy(s);
 	*r_g = (void *) g;
 	return 0;
 }
 
 static int
-graph_find_end_and_mark (graph_t *g, int prev, int n, int *n_node_res,
-	char **attributes, char *e_text, size_t e_size)
+graph_find_end_and_mark (graph_t *g, graph_id_t prev, graph_id_t n,
+	graph_id_t *n_node_res, int *attr, char *e_text, size_t e_size)
 {
-	*attributes = NULL;
+	*attr = 0;
 	node_t *node_tmp;
 	node_t *to = &(g->nodes[n]);
 
 	node_tmp = to;
 	while (node_tmp != NULL) {
-		if ((node_tmp->type != NODE_NODE) &&
+		if ((g->types[node_tmp->n] != NODE_NODE) &&
 			(node_tmp->n_adj > 2))
 		{
-			return return_error(e_text,
-				e_size, TOP_E_BADGATE, ": %s", node_tmp->name);
-		}
-		if (g->nodes[node_tmp->adj[0].n].type == NODE_GATE) {
-			if (node_tmp->adj[0].attributes)
-				*attributes = node_tmp->adj[0].attributes;
-			node_tmp->type = NODE_GATE_VISITED;
+			char *name = NULL;
+			size_t name_cap = 0;
+			if (!graph_node_name(g, node_tmp->n, &name, &name_cap))
+				return return_error(e_text, e_size, TOP_E_ALLOC, "");
+			return_error(e_text, e_size, TOP_E_BADGATE, ": %s", name);
+			free(name);
+			return TOP_E_BADGATE;
+		}
+		if (g->types[node_tmp->adj[0].n] == NODE_GATE) {
+			if (node_tmp->adj[0].attr)
+				*attr = node_tmp->adj[0].attr;
+			graph_set_type(g, node_tmp->n, NODE_GATE_VISITED);
 			node_tmp = &(g->nodes[node_tmp->adj[0].n]);
-		} else if ((g->nodes[node_tmp->adj[0].n].type == NODE_NODE) &&
+		} else if ((g->types[node_tmp->adj[0].n] == NODE_NODE) &&
 			(node_tmp->adj[0].n != prev))
 		{
-			if (node_tmp->adj[0].attributes)
-				*attributes = node_tmp->adj[0].attributes;
-			node_tmp->type = NODE_GATE_VISITED;
+			if (node_tmp->adj[0].attr)
+				*attr = node_tmp->adj[0].attr;
+			graph_set_type(g, node_tmp->n, NODE_GATE_VISITED);
 			node_tmp = &(g->nodes[node_tmp->adj[0].n]);
 			break;
 		} else {
 			if (node_tmp->n_adj == 1) {
 				break;
-			} else if (g->nodes[node_tmp->adj[1].n].type == NODE_GATE) {
-				if (node_tmp->adj[1].attributes)
-					*attributes = node_tmp->adj[1].attributes;
-				node_tmp->type = NODE_GATE_VISITED;
+			} else if (g->types[node_tmp->adj[1].n] == NODE_GATE) {
+				if (node_tmp->adj[1].attr)
+					*attr = node_tmp->adj[1].attr;
+				graph_set_type(g, node_tmp->n, NODE_GATE_VISITED);
 				node_tmp = &(g->nodes[node_tmp->adj[1].n]);
 			} else {
-				if (node_tmp->adj[1].attributes)
-					*attributes = node_tmp->adj[1].attributes;
-				node_tmp->type = NODE_GATE_VISITED;
+				if (node_tmp->adj[1].attr)
+					*attr = node_tmp->adj[1].attr;
+				graph_set_type(g, node_tmp->n, NODE_GATE_VISITED);
 				node_tmp = &(g->nodes[node_tmp->adj[1].n]);
 				break;
 			}
@@ -1068,29 +2257,32 @@ int
 topologies_graph_compact (void **v, char *e_text, size_t e_size)
 {
 	int res;
-	int n_node_a, n_node_b;
+	graph_id_t n_node_a, n_node_b;
 	graph_t *g = (graph_t *) *v;
-	graph_t *new_g = graph_create();
+	if (g->csr)
+		return return_error(e_text, e_size, TOP_E_FROZEN, "");
+	graph_t *new_g = graph_create(GRAPH_ARENA | GRAPH_ADJ_SET);
 	if (new_g == NULL)
 		return return_error(e_text, e_size, TOP_E_ALLOC, "");
 
-	for (int i = 0; i < g->n_nodes; i++) {
-		if (g->nodes[i].type != NODE_NODE)
-			continue;
-
-		for (int j = 0; j < g->nodes[i].n_adj; j++) {
-			if (g->nodes[g->nodes[i].adj[j].n].type == NODE_GATE) {
-				char *attrs;
+	for (graph_id_t i = graph_next_node(g, 0); i < g->n_nodes;
+		i = graph_next_node(g, i + 1))
+	{
+		for (graph_id_t j = 0; j < g->nodes[i].n_adj; j++) {
+			if (g->types[g->nodes[i].adj[j].n] == NODE_GATE) {
+				int attr;
 				res = graph_find_end_and_mark(g, i,
-					g->nodes[i].adj[j].n, &n_node_a, &attrs,
+					g->nodes[i].adj[j].n, &n_node_a, &attr,
 					e_text, e_size);
 				if (res) {
 					topologies_graph_destroy(new_g);
 					return res;
 				}
-				if (!graph_are_adjacent(&g->nodes[n_node_a], &g->nodes[i])) {
+				if (!graph_are_adjacent(g, &g->nodes[n_node_a],
+					&g->nodes[i]))
+				{
 					if ((res = graph_add_edge_id(g, n_node_a,
-						i, attrs)))
+						i, attr)))
 					{
 						topologies_graph_destroy(new_g);
 						return return_error(e_text,
@@ -1101,28 +2293,38 @@ topologies_graph_compact (void **v, char *e_text, size_t e_size)
 		}
 	}
 
-	for (int i = 0; i < g->n_nodes; i++) {
-		if (g->nodes[i].type == NODE_GATE_VISITED)
+	/* the compacted graph takes over the names and attributes instead of
+	 * copying them, so attribute ids stay valid */
+	name_trie_destroy(new_g->names);
+	new_g->names = g->names;
+	g->names = NULL;
+	str_pool_destroy(new_g->attrs);
+	new_g->attrs = g->attrs;
+	g->attrs = NULL;
+
+	for (graph_id_t i = 0; i < g->n_nodes; i++) {
+		if (g->types[i] == NODE_GATE_VISITED)
 			continue;
 		if (g->nodes[i].n_adj == 0)
 			continue;
-		if (graph_add_node(new_g, g->nodes[i].name, g->nodes[i].type, g->nodes[i].attributes))
+		if (graph_add_node_id(new_g, g->name_ids[i], g->types[i],
+			g->nodes[i].attr))
 			return return_error(e_text, e_size, TOP_E_ALLOC, "");
 	}
-	for (int i = 0; i < g->n_nodes; i++) {
-		if (g->nodes[i].type == NODE_GATE_VISITED)
+	for (graph_id_t i = 0; i < g->n_nodes; i++) {
+		if (g->types[i] == NODE_GATE_VISITED)
 			continue;
-		for (int j = 0; j < g->nodes[i].n_adj; j++) {
+		for (graph_id_t j = 0; j < g->nodes[i].n_adj; j++) {
 			if ((i < g->nodes[i].adj[j].n) &&
-				(g->nodes[g->nodes[i].adj[j].n].type !=
+				(g->types[g->nodes[i].adj[j].n] !=
 				NODE_GATE_VISITED))
 			{
-				n_node_a = graph_find_node(new_g,
-					g->nodes[i].name);
-				n_node_b = graph_find_node(new_g,
-					g->nodes[g->nodes[i].adj[j].n].name);
+				n_node_a = graph_find_node_id(new_g,
+					g->name_ids[i]);
+				n_node_b = graph_find_node_id(new_g,
+					g->name_ids[g->nodes[i].adj[j].n]);
 				graph_add_edge_id(new_g, n_node_a, n_node_b,
-					g->nodes[i].adj[j].attributes);
+					g->nodes[i].adj[j].attr);
 			}
 		}
 	}
@@ -1173,6 +2375,8 @@ free_connection (connection_wrapper_t *c)
 	if (c->type == CONN_HAS_CONN) {
 		free(c->ptr.conn->from);
 		free(c->ptr.conn->to);
+		name_tmpl_destroy(c->ptr.conn->from_tmpl);
+		name_tmpl_destroy(c->ptr.conn->to_tmpl);
 		free(c->ptr.conn->attributes);
 		free(c->ptr.conn);
 	} else if (c->type == CONN_HAS_COND) {
@@ -1189,6 +2393,7 @@ free_connection (connection_wrapper_t *c)
 		free(c->ptr.line->start);
 		free(c->ptr.line->end);
 		free(c->ptr.line->nodes);
+		name_tmpl_destroy(c->ptr.line->nodes_tmpl);
 		free(c->ptr.line->attributes);
 		free(c->ptr.line);
 	} else if (c->type == CONN_HAS_RING) {
@@ -1196,6 +2401,7 @@ free_connection (connection_wrapper_t *c)
 		free(c->ptr.ring->start);
 		free(c->ptr.ring->end);
 		free(c->ptr.ring->nodes);
+		name_tmpl_destroy(c->ptr.ring->nodes_tmpl);
 		free(c->ptr.ring->attributes);
 		free(c->ptr.ring);
 	} else if (c->type == CONN_HAS_ALLLIST) {
@@ -1203,6 +2409,7 @@ free_connection (connection_wrapper_t *c)
 		free(c->ptr.alllist->start);
 		free(c->ptr.alllist->end);
 		free(c->ptr.alllist->nodes);
+		name_tmpl_destroy(c->ptr.alllist->nodes_tmpl);
 		free(c->ptr.alllist->attributes);
 		free(c->ptr.alllist);
 	} else if (c->type == CONN_HAS_ALL) {
@@ -1277,6 +2484,7 @@ topologies_network_destroy (void *v)
 		free(n->network->module);
 		free(n->network);
 	}
+	expr_cache_destroy(n->exprs);
 	free(n);
 }
 
@@ -1300,11 +2508,16 @@ topologies_network_read_file (void *net, char *filename, char *e_text, size_t e_
 		return res;
 	res = json_read_file(addr, file_size, net, e_text, e_size);
 	file_close(addr, file_size);
-	return res;
+	if (res)
+		return res;
+	return network_compile(net, e_text, e_size);
 }
 
 int
 topologies_network_read_string (void *net, char *addr, char *e_text, size_t e_size)
 {
-	return json_read_file(addr, strlen(addr), net, e_text, e_size);
+	int res;
+	if ((res = json_read_file(addr, strlen(addr), net, e_text, e_size)))
+		return res;
+	return network_compile(net, e_text, e_size);
 }
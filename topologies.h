@@ -2,9 +2,16 @@ int
 topologies_definition_to_graph (void *n, void **g, char *e_text,
 	size_t e_size);
 
+int
+topologies_definition_size (void *n, long *n_nodes, long *n_gates,
+	long *n_edges, bool *exact, char *e_text, size_t e_size);
+
 int
 topologies_graph_compact (void **g, char *e_text, size_t e_size);
 
+int
+topologies_graph_freeze (void *g, char *e_text, size_t e_size);
+
 void
 topologies_network_destroy (void *n);
 
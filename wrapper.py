@@ -30,10 +30,20 @@ class Topologies:
             [ctypes.c_void_p, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
         self.library.topologies_definition_to_graph.restype = ctypes.c_int
 
+        self.library.topologies_definition_size.argtypes = \
+            [ctypes.c_void_p, ctypes.POINTER(ctypes.c_long),
+            ctypes.POINTER(ctypes.c_long), ctypes.POINTER(ctypes.c_long),
+            ctypes.POINTER(ctypes.c_bool), ctypes.c_char_p, ctypes.c_size_t]
+        self.library.topologies_definition_size.restype = ctypes.c_int
+
         self.library.topologies_graph_compact.argtypes = \
             [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
         self.library.topologies_graph_compact.restype = ctypes.c_int
 
+        self.library.topologies_graph_freeze.argtypes = \
+            [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_size_t]
+        self.library.topologies_graph_freeze.restype = ctypes.c_int
+
         self.library.topologies_graph_string.argtypes = \
             [ctypes.c_void_p, ctypes.c_bool]
         self.library.topologies_graph_string.restype = ctypes.c_void_p
@@ -57,6 +67,9 @@ class Topologies:
             if self.library.topologies_graph_compact(ctypes.byref(self.graph),
                 self.e_buf, ctypes.sizeof(self.e_buf)):
                     raise ValueError(str(self.e_buf.value, 'utf-8'))
+        if self.library.topologies_graph_freeze(self.graph,
+            self.e_buf, ctypes.sizeof(self.e_buf)):
+                raise ValueError(str(self.e_buf.value, 'utf-8'))
 
         self.dot_ptr = self.library.topologies_graph_string(self.graph,
             print_gates)